@@ -0,0 +1,70 @@
+/**
+ * SPISD CRC benchmark
+ * Measures the cost of CRC16 over a 512 byte block and compares block
+ * reads with and without CRC protection at the card's SPI clock.
+ * License: GNU General Public License V3
+ * (Because Arduino SD library is licensed with this.)
+ */
+#include <SPI.h>
+#include <SPISD.h>
+#include <utility/SpiSdCrc.h>
+
+#define BLOCK_COUNT 200
+
+SpiSd2Card card(SPI5);
+uint8_t buf[512];
+
+uint32_t readBlocks() {
+  uint32_t t0 = micros();
+  for (uint32_t i = 0; i < BLOCK_COUNT; i++) {
+    if (!card.readBlock(i, buf)) {
+      Serial.print("readBlock failed, error ");
+      Serial.println(card.errorCode(), HEX);
+      return 0;
+    }
+  }
+  return micros() - t0;
+}
+
+void setup() {
+  Serial.begin(115200);
+  if (!card.init(SPI_HALF_SPEED) || !card.rampSpiClock(0)) {
+    Serial.println("card.init() failed");
+    return;
+  }
+  Serial.print("SPI clock: ");
+  Serial.println(card.spiClock());
+
+  // CRC16 of one block
+  volatile uint16_t crc = 0;
+  uint32_t t0 = micros();
+  for (uint16_t i = 0; i < 1000; i++) {
+    buf[0] = i;
+    crc ^= SpiSdCrc16(buf, 512);
+  }
+  float crcUs = (micros() - t0) / 1000.0;
+  float busUs = 514 * 8 * 1e6 / card.spiClock();
+  Serial.print("CRC16 512 bytes: ");
+  Serial.print(crcUs);
+  Serial.print(" us, bus transfer: ");
+  Serial.print(busUs);
+  Serial.print(" us, ");
+  Serial.print(100 * crcUs / busUs);
+  Serial.println(" %");
+
+  uint32_t plain = readBlocks();
+  card.useCrc(true);
+  uint32_t checked = readBlocks();
+  card.useCrc(false);
+  if (!plain || !checked) return;
+
+  Serial.print("read without CRC: ");
+  Serial.print(BLOCK_COUNT * 512.0 / plain * 1e6 / 1024);
+  Serial.println(" KB/s");
+  Serial.print("read with CRC:    ");
+  Serial.print(BLOCK_COUNT * 512.0 / checked * 1e6 / 1024);
+  Serial.println(" KB/s");
+}
+
+void loop() {
+}
@@ -0,0 +1,47 @@
+/**
+ * SPISD free space benchmark
+ * Times the FAT scan behind SD.freeClusterCount() and the cached count
+ * that later calls return.  Use a card formatted with a full-size FAT,
+ * for example a 2GB FAT16 card or a 32GB FAT32 card.
+ * License: GNU General Public License V3
+ * (Because Arduino SD library is licensed with this.)
+ */
+#include <SPI.h>
+#include <SPISD.h>
+
+SpiSDClass SD(SPI5);
+
+void setup() {
+  Serial.begin(115200);
+  if (!SD.begin(SPI_FULL_SPEED)) {
+    Serial.println("SD.begin() failed");
+    return;
+  }
+
+  // FAT32 cards usually have a count in FSInfo, recount to time the scan
+  uint32_t t0 = micros();
+  uint32_t clusters = SD.freeClusterCount(true);
+  uint32_t scanUs = micros() - t0;
+  if (clusters == 0XFFFFFFFF) {
+    Serial.println("freeClusterCount() failed");
+    return;
+  }
+
+  t0 = micros();
+  clusters = SD.freeClusterCount();
+  uint32_t cachedUs = micros() - t0;
+
+  Serial.print("free clusters: ");
+  Serial.println(clusters);
+  Serial.print("free MB: ");
+  Serial.println((uint32_t)(SD.freeBytes() >> 20));
+  Serial.print("FAT scan: ");
+  Serial.print(scanUs / 1000.0);
+  Serial.println(" ms");
+  Serial.print("cached count: ");
+  Serial.print(cachedUs);
+  Serial.println(" us");
+}
+
+void loop() {
+}
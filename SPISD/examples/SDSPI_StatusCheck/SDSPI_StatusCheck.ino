@@ -0,0 +1,62 @@
+/**
+ * SPISD status check bus bytes
+ * Writes the same file with each SD.statusCheck() policy and prints the
+ * bytes clocked on the SPI bus per written block.  Set SPISD_BUS_STATS
+ * to 1 in utility/SpiSd2Card.h to build it.
+ * License: GNU General Public License V3
+ * (Because Arduino SD library is licensed with this.)
+ */
+#include <SPI.h>
+#include <SPISD.h>
+
+#if !SPISD_BUS_STATS
+#error "set SPISD_BUS_STATS to 1 in utility/SpiSd2Card.h"
+#endif
+
+// file size and write size, small writes go through the block cache
+#define FILE_SIZE  65536
+#define CHUNK_SIZE 100
+
+SpiSDClass SD(SPI5);
+uint8_t buf[CHUNK_SIZE];
+
+void measure(const char* name, uint8_t policy) {
+  SD.statusCheck(policy);
+  SD.remove("STATUS.BIN");
+  SpiFile file = SD.open("STATUS.BIN", FILE_WRITE);
+  if (!file) {
+    Serial.println("open failed");
+    return;
+  }
+  SD.card.busBytesClear();
+  for (uint32_t n = 0; n < FILE_SIZE; n += CHUNK_SIZE) {
+    file.write(buf, CHUNK_SIZE);
+  }
+  file.close();
+  uint32_t bytes = SD.card.busBytes();
+
+  Serial.print(name);
+  Serial.print(": ");
+  Serial.print(bytes);
+  Serial.print(" bus bytes, ");
+  Serial.print(bytes / (FILE_SIZE / 512));
+  Serial.println(" per data block");
+}
+
+void setup() {
+  Serial.begin(115200);
+  if (!SD.begin(SPI_FULL_SPEED)) {
+    Serial.println("SD.begin() failed");
+    return;
+  }
+  for (uint16_t i = 0; i < CHUNK_SIZE; i++) {
+    buf[i] = i;
+  }
+  measure("SD_STATUS_CHECK_ALWAYS", SD_STATUS_CHECK_ALWAYS);
+  measure("SD_STATUS_CHECK_SYNC", SD_STATUS_CHECK_SYNC);
+  measure("SD_STATUS_CHECK_NEVER", SD_STATUS_CHECK_NEVER);
+  SD.statusCheck(SD_STATUS_CHECK_ALWAYS);
+}
+
+void loop() {
+}
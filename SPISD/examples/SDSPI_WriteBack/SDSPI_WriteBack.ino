@@ -0,0 +1,49 @@
+/**
+ * SPISD write-back policy
+ * Logs a line every 10 ms without flush().  SD.writeBack() writes the
+ * cached blocks and the file size once 8 blocks are dirty or one second
+ * after the first change, and SD.tick() in loop() keeps the time limit
+ * while nothing is written.  Remove the card at any time, the file holds
+ * the lines of the last batch.
+ * License: GNU General Public License V3
+ * (Because Arduino SD library is licensed with this.)
+ */
+#include <SPI.h>
+#include <SPISD.h>
+
+SpiSDClass SD(SPI5);
+SpiFile logFile;
+uint32_t lastLog;
+uint32_t lineCount;
+
+void setup() {
+  Serial.begin(115200);
+  if (!SD.begin(SPI_FULL_SPEED)) {
+    Serial.println("SD.begin() failed");
+    return;
+  }
+  SD.writeBack(8, 1000);
+  logFile = SD.open("WB_LOG.TXT", FILE_WRITE);
+  if (!logFile) {
+    Serial.println("open failed");
+    return;
+  }
+  Serial.println("logging");
+}
+
+void loop() {
+  if (!logFile)
+    return;
+
+  if (millis() - lastLog >= 10) {
+    lastLog = millis();
+    logFile.print(lineCount++);
+    logFile.print(',');
+    logFile.println(lastLog);
+  }
+
+  if (!SD.tick()) {
+    Serial.println("write failed");
+    logFile.close();
+  }
+}
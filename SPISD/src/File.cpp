@@ -6,20 +6,26 @@
 
 #include <SPISD.h>
 
+static char noName[1];
+
 SpiFile::SpiFile(SpiSdFile f, const char *n) 
 {
-  _file = (SpiSdFile*)malloc(sizeof(SpiSdFile)); 
+  // exFAT names can be long, so only as much as the name needs is allocated
+  size_t len = strlen(n);
+  _file = (SpiSdFile*)malloc(sizeof(SpiSdFile) + len + 1); 
   if (_file) {
     memcpy(_file, &f, sizeof(SpiSdFile));
-    strncpy(_name, n, 12);
-    _name[12] = 0;
+    _name = (char*)(_file + 1);
+    memcpy(_name, n, len + 1);
+  } else {
+    _name = noName;
   }
 }
 
 SpiFile::SpiFile(void) 
 {
   _file = 0;
-  _name[0] = 0;
+  _name = noName;
 }
 
 char *SpiFile::name(void) 
@@ -81,7 +87,7 @@ int SpiFile::read(void *buf, uint16_t nbyte)
 int SpiFile::available() 
 {
   // if (!_file) return 0;
-  uint32_t n = size() - position();
+  uint64_t n = size() - position();
   return n > 0X7FFF ? 0X7FFF : n;
 }
 
@@ -90,19 +96,19 @@ void SpiFile::flush()
   if (_file) _file->sync();
 }
 
-boolean SpiFile::seek(uint32_t pos) 
+boolean SpiFile::seek(uint64_t pos) 
 {
   if (!_file) return false;
   return _file->seekSet(pos);
 }
 
-uint32_t SpiFile::position() 
+uint64_t SpiFile::position() 
 {
   if (! _file) return -1;
   return _file->curPosition();
 }
 
-uint32_t SpiFile::size() 
+uint64_t SpiFile::size() 
 {
   if (! _file) return 0;
   return _file->fileSize();
@@ -114,6 +120,7 @@ void SpiFile::close()
     _file->close();
     free(_file); 
     _file = 0;
+    _name = noName;
   }
 }
 
@@ -7,9 +7,14 @@
 
 #include "SPISD.h"
 
-#define MAX_COMPONENT_LEN 12 
+// an 8.3 name on FAT volumes, a long name on exFAT volumes
+#define MAX_COMPONENT_LEN 225 
 #define PATH_COMPONENT_BUFFER_LEN MAX_COMPONENT_LEN+1
 
+// one component buffer for walkPath(), getParentDir() and openNextFile(),
+// kept off the stack; none of them calls another while it is in use
+static char pathComponent[PATH_COMPONENT_BUFFER_LEN];
+
 /**
  * Parse individual path components from a path.
  *
@@ -88,7 +93,7 @@ boolean walkPath(const char *filepath, SpiSdFile& parentDir
   SpiSdFile subfile1;
   SpiSdFile subfile2;
 
-  char buffer[PATH_COMPONENT_BUFFER_LEN]; 
+  char *buffer = pathComponent; 
   unsigned int offset = 0;
 
   SpiSdFile *p_parent;
@@ -202,19 +207,54 @@ boolean callback_rmdir(SpiSdFile& parentDir
 
 boolean SpiSDClass::begin(void) 
 {
-  return card.init(SPI_HALF_SPEED) 
-         && volume.init(card) 
-         && root.openRoot(volume);
+  return begin(0, SD_CHIP_SELECT_AUTO);
 }
 
 boolean SpiSDClass::begin(uint32_t clock) 
 {
-  return card.init(SPI_HALF_SPEED)
-         && card.setSpiClock(clock)
+  return begin(clock, SD_CHIP_SELECT_AUTO);
+}
+
+boolean SpiSDClass::begin(uint32_t clock, uint8_t chipSelectPin) 
+{
+  // clock is an upper limit, zero lets the card's rated clock decide
+  return card.init(SPI_HALF_SPEED, chipSelectPin)
+         && card.rampSpiClock(clock)
          && volume.init(card) 
          && root.openRoot(volume);
 }
 
+boolean SpiSDClass::beginAsync(uint32_t clock, uint8_t chipSelectPin) 
+{
+  mountClock = clock;
+  mountPending = card.initAsync(SPI_HALF_SPEED, chipSelectPin);
+  return mountPending;
+}
+
+uint8_t SpiSDClass::poll(void) 
+{
+  uint8_t status = card.asyncPoll();
+  if (status == SD_ASYNC_PENDING) 
+    return status;
+
+  if (!mountPending) {
+    // use the idle card to erase freed clusters, a bounded piece per
+    // call since the next card command waits for the erase
+    if (volume.discard() == SD_DISCARD_IDLE) 
+      volume.discardPoll();
+    return status;
+  }
+
+  // the card is ready, select the clock and mount the volume
+  mountPending = 0;
+  if (status == SD_ASYNC_DONE 
+      && card.rampSpiClock(mountClock)
+      && volume.init(card) 
+      && root.openRoot(volume)) 
+    return SD_ASYNC_DONE;
+  return SD_ASYNC_ERROR;
+}
+
 SpiSdFile SpiSDClass::getParentDir(const char *filepath, int *index) 
 {
   SpiSdFile d1 = root; 
@@ -235,9 +275,9 @@ SpiSdFile SpiSDClass::getParentDir(const char *filepath, int *index)
     if (!strchr(filepath, '/')) 
       break;
 
-    uint8_t idx = strchr(filepath, '/') - filepath;
-    if (idx > 12) idx = 12;  // dont let them specify long names
-    char subdirname[13];
+    int idx = strchr(filepath, '/') - filepath;
+    if (idx > MAX_COMPONENT_LEN) idx = MAX_COMPONENT_LEN;
+    char *subdirname = pathComponent;
     strncpy(subdirname, filepath, idx);
     subdirname[idx] = 0;
 
@@ -340,31 +380,13 @@ boolean SpiSDClass::remove(const char *filepath)
 
 SpiFile SpiFile::openNextFile(uint8_t mode) 
 {
-  dir_t p;
-  while (_file->readDir(&p) > 0) {
-
-    if (p.name[0] == DIR_NAME_FREE) 
-      return SpiFile();
-
-    if (p.name[0] == DIR_NAME_DELETED || p.name[0] == '.') 
-      continue;
-
-    // only list subdirectories and files
-    if (!DIR_IS_FILE_OR_SUBDIR(&p)) 
-      continue;
-
-    // print file name with possible blank fill
-    SpiSdFile f;
-    char name[13];
-    _file->dirName(p, name);
-
-    if (f.open(_file, name, mode)) 
-      return SpiFile(f, name);    
-    else
-      return SpiFile();
-  }
+  // FAT and exFAT directories, the whole name is kept so it can reopen the file
+  SpiSdFile f;
+  if (!f.openNext(_file, mode) 
+      || !f.getName(pathComponent, sizeof(pathComponent))) 
+    return SpiFile();
 
-  return SpiFile();
+  return SpiFile(f, pathComponent);
 }
 
 void SpiFile::rewindDirectory(void) 
@@ -17,7 +17,7 @@
 class SpiFile : public Stream 
 {
 private:
-  char _name[13]; 
+  char *_name;    // stored after *_file in the same allocation
   SpiSdFile *_file;  
 
 public:
@@ -30,9 +30,9 @@ public:
   virtual int available();
   virtual void flush();
   int read(void *buf, uint16_t nbyte);
-  boolean seek(uint32_t pos);
-  uint32_t position();
-  uint32_t size();
+  boolean seek(uint64_t pos);
+  uint64_t position();
+  uint64_t size();
   void close();
   operator bool();
   char * name();
@@ -55,9 +55,108 @@ private:
   SpiSdFile getParentDir(const char *filepath, int *indx);
 
 public:
-  SpiSDClass(SPIClass& spi): card(spi) {}
+  SpiSDClass(SPIClass& spi): card(spi), mountPending(0) {}
   boolean begin(void);
   boolean begin(uint32_t clock);
+  boolean begin(uint32_t clock, uint8_t chipSelectPin);
+
+  /** 
+   * Start begin() without blocking, call poll() from loop() until it
+   * returns SD_ASYNC_DONE or SD_ASYNC_ERROR.
+   */
+  boolean beginAsync(uint32_t clock = 0
+            ,uint8_t chipSelectPin = SD_CHIP_SELECT_AUTO);
+  uint8_t poll(void);
+
+  /** 
+   * Return from block writes before the card has programmed flash,
+   * the busy wait moves to the next card command.  Errors are reported
+   * by flush() and close().
+   */
+  void writeBehind(boolean enable) { card.writeBehind(enable); }
+
+  /** 
+   * Select when card status is read after writes: SD_STATUS_CHECK_ALWAYS,
+   * SD_STATUS_CHECK_SYNC or SD_STATUS_CHECK_NEVER.
+   */
+  void statusCheck(uint8_t policy) { card.statusCheck(policy); }
+
+  /** 
+   * Protect commands and data with CRC, failed transfers are retried.
+   * Call before begin() to check the clock ramp with CRC as well.
+   */
+  boolean useCrc(boolean enable) { return card.useCrc(enable); }
+
+  /** 
+   * Keep several dirty FAT blocks in the FAT cache until flush() or
+   * close(), the default.  If false a FAT block is written as soon as
+   * another one is needed.
+   */
+  void fatWriteBack(boolean enable) { SpiSdVolume::fatWriteBack(enable); }
+
+  /** 
+   * Write the second FAT only at file flush() and close() and at
+   * SD.flush() instead of with every FAT block.
+   */
+  void fatMirrorDefer(boolean enable) { 
+    SpiSdVolume::fatMirrorDefer(enable); 
+  }
+
+  /** 
+   * Keep the whole FAT in RAM if it is no larger than maxBytes, zero
+   * goes back to the FAT cache.  Changed FAT blocks are written by
+   * flush() and close().  Call before begin() or on a mounted card.
+   * Returns false if the FAT does not fit or there is not enough memory.
+   */
+  boolean fatInRam(uint32_t maxBytes) { return volume.fatInRam(maxBytes); }
+
+  /** 
+   * Keep a bitmap of used clusters in RAM, one bit per cluster, so
+   * allocation does not search the FAT.  Call before begin() or on a
+   * mounted card.  Returns false if there is not enough memory.
+   */
+  boolean freeBitmap(boolean enable) { return volume.freeBitmap(enable); }
+
+  /** 
+   * Number of free clusters, 0XFFFFFFFF for an error.  The first call
+   * may read the whole FAT, later calls return at once.  With \a recount
+   * the FAT is read again.
+   */
+  uint32_t freeClusterCount(boolean recount = false) { 
+    return volume.freeClusterCount(recount); 
+  }
+
+  /** Free space in bytes, zero for an error. */
+  uint64_t freeBytes(void) {
+    uint32_t n = volume.freeClusterCount();
+    if (n == 0XFFFFFFFF) return 0;
+    return (uint64_t)n << (volume.clusterSizeShift() + 9);
+  }
+
+  /** Write all cached blocks, FAT copies and FSInfo to the card. */
+  boolean flush(void) { return volume.flush(); }
+
+  /** 
+   * Write cached blocks in one batch once maxDirty of them are dirty or
+   * maxMs milliseconds after the first change, zero turns a limit off.
+   * With both zero, the default, blocks are written by flush() and
+   * close() or when the cache is full.  Call tick() from loop().
+   */
+  void writeBack(uint8_t maxDirty, uint32_t maxMs) { 
+    SpiSdVolume::writeBack(maxDirty, maxMs); 
+  }
+
+  /** Flush if a writeBack() limit is reached, false for an error. */
+  boolean tick(void) { return volume.tick(); }
+
+  /** 
+   * Erase clusters freed by remove() and truncate(): SD_DISCARD_OFF,
+   * SD_DISCARD_NOW or SD_DISCARD_IDLE.  In idle mode poll() starts the
+   * erases while no other card operation is running, at most
+   * SPISD_DISCARD_POLL_BLOCKS blocks per call.  A file operation
+   * started during an erase waits for it.
+   */
+  void discard(uint8_t mode) { volume.discard(mode); }
   
   SpiFile open(const char *filename, uint8_t mode = FILE_READ);
   SpiFile open(const String &filename, uint8_t mode = FILE_READ) { 
@@ -86,6 +185,8 @@ public:
 
 private:
   int fileOpenMode;
+  uint32_t mountClock;
+  uint8_t mountPending;
   
   friend class SpiFile;
   friend boolean callback_openPath(SpiSdFile& ,const char * ,boolean ,void *); 
@@ -338,6 +338,50 @@ uint32_t const FAT32MASK = 0X0FFFFFFF;
 /** Type name for fat32BootSector */
 typedef struct fat32BootSector fbs_t;
 
+/** Lead signature for a FSInfo sector */
+uint32_t const FSINFO_LEAD_SIG = 0X41615252;
+
+/** Struct signature for a FSInfo sector */
+uint32_t const FSINFO_STRUCT_SIG = 0X61417272;
+
+/**
+ *  \struct fat32FsInfo
+ *  \brief FSInfo sector for a FAT32 volume.
+ */
+struct fat32FsInfo {
+
+  /** must be 0X41615252 */
+  uint32_t leadSignature;
+
+  /** must be zero */
+  uint8_t  reserved1[480];
+
+  /** must be 0X61417272 */
+  uint32_t structSignature;
+
+  /** 
+   *  Last known free cluster count on the volume, 0XFFFFFFFF if
+   *  unknown.  A hint that may be wrong.
+   */
+  uint32_t freeCount;
+
+  /** 
+   *  Cluster number at which to start looking for free clusters,
+   *  0XFFFFFFFF if unknown.
+   */
+  uint32_t nextFree;
+
+  /** must be zero */
+  uint8_t  reserved2[12];
+
+  /** must be 0X00, 0X00, 0X55, 0XAA */
+  uint8_t  tailSignature[4];
+
+} __attribute__((packed));
+
+/** Type name for fat32FsInfo */
+typedef struct fat32FsInfo fsinfo_t;
+
 /**
  *  \struct directoryEntry
  *  \brief FAT short directory entry
@@ -490,5 +534,316 @@ static inline uint8_t DIR_IS_FILE_OR_SUBDIR(const dir_t* dir) {
   return (dir->attributes & DIR_ATT_VOLUME_ID) == 0;
 }
 
+/**
+ *  \struct exFatBootSector
+ *  \brief Boot sector for an exFAT volume.
+ *
+ *  Sizes are powers of two given as shifts, offsets are in sectors from
+ *  the start of the volume.  Fields are from the Microsoft exFAT File
+ *  System Specification.
+ */
+struct exFatBootSector {
+
+  /** X86 jmp to boot program */
+  uint8_t  jmpToBootCode[3];
+
+  /** must be "EXFAT   " */
+  char     oemName[8];
+
+  /** must be zero, where the BIOS parameter block of a FAT volume is */
+  uint8_t  mustBeZero[53];
+
+  /** media-relative sector offset of the volume */
+  uint64_t partitionOffset;
+
+  /** size of the volume in sectors */
+  uint64_t volumeLength;
+
+  /** sector offset of the first FAT */
+  uint32_t fatOffset;
+
+  /** sectors in one FAT */
+  uint32_t fatLength;
+
+  /** sector offset of cluster two, the first cluster of the data */
+  uint32_t clusterHeapOffset;
+
+  /** number of clusters in the cluster heap */
+  uint32_t clusterCount;
+
+  /** first cluster of the root directory */
+  uint32_t rootDirectoryCluster;
+
+  /** usually generated by combining date and time */
+  uint32_t volumeSerialNumber;
+
+  /** exFAT revision, high byte major, low byte minor */
+  uint16_t fileSystemRevision;
+
+  /** 
+   *  Bit 0 -- active FAT and allocation bitmap, zero for the first.
+   *  Bit 1 -- volume dirty.
+   *  Bit 2 -- media failure.
+   */
+  uint16_t volumeFlags;
+
+  /** log2 of the bytes per sector, 9 for 512 byte sectors */
+  uint8_t  bytesPerSectorShift;
+
+  /** log2 of the sectors per cluster */
+  uint8_t  sectorsPerClusterShift;
+
+  /** number of FATs, two only for TexFAT */
+  uint8_t  numberOfFats;
+
+  /** for int0x13 use value 0X80 for hard drive */
+  uint8_t  driveSelect;
+
+  /** percentage of allocated clusters, 0XFF if not available */
+  uint8_t  percentInUse;
+
+  /** reserved */
+  uint8_t  reserved[7];
+
+  /** X86 boot code */
+  uint8_t  bootCode[390];
+
+  /** must be 0X55 */
+  uint8_t  bootSectorSig0;
+
+  /** must be 0XAA */
+  uint8_t  bootSectorSig1;
+
+} __attribute__((packed));
+
+/** Type name for exFatBootSector */
+typedef struct exFatBootSector exfbs_t;
+
+/** exFAT end of chain value. */
+uint32_t const EXFAT_EOC = 0XFFFFFFFF;
+
+// exFAT directory entry types, bit 7 is set while the entry is in use
+
+/** type of the entry that ends a directory, no entries in use follow */
+uint8_t const EXFAT_TYPE_END = 0X00;
+
+/** type of the allocation bitmap entry */
+uint8_t const EXFAT_TYPE_BITMAP = 0X81;
+
+/** type of the up-case table entry */
+uint8_t const EXFAT_TYPE_UPCASE = 0X82;
+
+/** type of the volume label entry */
+uint8_t const EXFAT_TYPE_LABEL = 0X83;
+
+/** type of the first entry of a file or directory entry set */
+uint8_t const EXFAT_TYPE_FILE = 0X85;
+
+/** type of the stream extension entry that follows the file entry */
+uint8_t const EXFAT_TYPE_STREAM = 0XC0;
+
+/** type of a file name entry, each holds 15 characters of the name */
+uint8_t const EXFAT_TYPE_NAME = 0XC1;
+
+/** bit of the entry type that is set while the entry is in use */
+uint8_t const EXFAT_TYPE_IN_USE = 0X80;
+
+/** stream flag, the file has clusters allocated */
+uint8_t const EXFAT_FLAG_ALLOC_POSSIBLE = 0X01;
+
+/** stream flag, the clusters are contiguous and the FAT is not used */
+uint8_t const EXFAT_FLAG_NO_FAT_CHAIN = 0X02;
+
+/** characters in a file name entry */
+uint8_t const EXFAT_NAME_CHARS = 15;
+
+/**
+ *  \struct exFatDirBitmap
+ *  \brief exFAT allocation bitmap directory entry
+ *
+ *  Bit n of the bitmap is set if cluster n + 2 is in use.
+ */
+struct exFatDirBitmap {
+
+  /** EXFAT_TYPE_BITMAP */
+  uint8_t  type;
+
+  /** bit 0 -- zero for the bitmap of the first FAT */
+  uint8_t  flags;
+
+  /** reserved */
+  uint8_t  reserved[18];
+
+  /** first cluster of the bitmap */
+  uint32_t firstCluster;
+
+  /** size of the bitmap in bytes */
+  uint64_t size;
+
+} __attribute__((packed));
+
+/** Type name for exFatDirBitmap */
+typedef struct exFatDirBitmap exbitmap_t;
+
+/**
+ *  \struct exFatDirUpcase
+ *  \brief exFAT up-case table directory entry
+ *
+ *  The table maps each UTF-16 character, from zero up, to its upper
+ *  case.  0XFFFF followed by a count n means the next n characters map
+ *  to themselves.
+ */
+struct exFatDirUpcase {
+
+  /** EXFAT_TYPE_UPCASE */
+  uint8_t  type;
+
+  /** reserved */
+  uint8_t  reserved1[3];
+
+  /** checksum of the table */
+  uint32_t checksum;
+
+  /** reserved */
+  uint8_t  reserved2[12];
+
+  /** first cluster of the table */
+  uint32_t firstCluster;
+
+  /** size of the table in bytes */
+  uint64_t size;
+
+} __attribute__((packed));
+
+/** Type name for exFatDirUpcase */
+typedef struct exFatDirUpcase exupcase_t;
+
+/**
+ *  \struct exFatDirFile
+ *  \brief exFAT file directory entry
+ *
+ *  The first entry of the entry set of a file or directory, followed by
+ *  a stream extension entry and the file name entries.  Dates and times
+ *  have the format of a FAT directory entry.
+ */
+struct exFatDirFile {
+
+  /** EXFAT_TYPE_FILE */
+  uint8_t  type;
+
+  /** number of entries that follow in the set, 2 to 18 */
+  uint8_t  setCount;
+
+  /** checksum of the entry set, without these two bytes */
+  uint16_t checksum;
+
+  /** attributes, the bits of DIR_ATT_READ_ONLY to DIR_ATT_ARCHIVE */
+  uint16_t attributes;
+
+  /** reserved */
+  uint16_t reserved1;
+
+  /** Time file was created. */
+  uint16_t createTime;
+
+  /** Date file was created. */
+  uint16_t createDate;
+
+  /** Time of last write. */
+  uint16_t modifyTime;
+
+  /** Date of last write. */
+  uint16_t modifyDate;
+
+  /** Time of last access. */
+  uint16_t accessTime;
+
+  /** Date of last access. */
+  uint16_t accessDate;
+
+  /** hundredths of a second to add to createTime, 0-199 */
+  uint8_t  create10ms;
+
+  /** hundredths of a second to add to modifyTime, 0-199 */
+  uint8_t  modify10ms;
+
+  /** offset of createTime from UTC, zero if unknown */
+  uint8_t  createTzOffset;
+
+  /** offset of modifyTime from UTC, zero if unknown */
+  uint8_t  modifyTzOffset;
+
+  /** offset of accessTime from UTC, zero if unknown */
+  uint8_t  accessTzOffset;
+
+  /** reserved */
+  uint8_t  reserved2[7];
+
+} __attribute__((packed));
+
+/** Type name for exFatDirFile */
+typedef struct exFatDirFile exfile_t;
+
+/**
+ *  \struct exFatDirStream
+ *  \brief exFAT stream extension directory entry
+ */
+struct exFatDirStream {
+
+  /** EXFAT_TYPE_STREAM */
+  uint8_t  type;
+
+  /** EXFAT_FLAG_ALLOC_POSSIBLE and EXFAT_FLAG_NO_FAT_CHAIN */
+  uint8_t  flags;
+
+  /** reserved */
+  uint8_t  reserved1;
+
+  /** number of characters in the name */
+  uint8_t  nameLength;
+
+  /** hash of the up-case name */
+  uint16_t nameHash;
+
+  /** reserved */
+  uint16_t reserved2;
+
+  /** bytes written, the rest up to dataLength read as zero */
+  uint64_t validLength;
+
+  /** reserved */
+  uint32_t reserved3;
+
+  /** first cluster, zero for an empty file */
+  uint32_t firstCluster;
+
+  /** size of the file in bytes */
+  uint64_t dataLength;
+
+} __attribute__((packed));
+
+/** Type name for exFatDirStream */
+typedef struct exFatDirStream exstream_t;
+
+/**
+ *  \struct exFatDirName
+ *  \brief exFAT file name directory entry
+ */
+struct exFatDirName {
+
+  /** EXFAT_TYPE_NAME */
+  uint8_t  type;
+
+  /** must be zero */
+  uint8_t  flags;
+
+  /** UTF-16 characters of the name, zero filled after the last one */
+  uint16_t unicode[15];
+
+} __attribute__((packed));
+
+/** Type name for exFatDirName */
+typedef struct exFatDirName exname_t;
+
 
 #endif  // SpiFatStructs_h
@@ -19,42 +19,317 @@
  */
 #include <Arduino.h>
 #include "SpiSd2Card.h"
+#include "SpiSdCrc.h"
 
 #include <SPI.h>
+
+// clock settings for command and data transfers, the identification
+// clock until init() has selected the data rate
 static SPISettings settings;
 
+// scratch buffer for buffer transfers, SPIClass::transfer() overwrites
+// the data it sends with the data it receives
+static uint8_t spiBuf[512];
+
+// TRAN_SPEED time values times ten, indexed by bits 6:3
+static const uint8_t tranSpeedValue[16] = {
+  0, 10, 12, 13, 15, 20, 25, 30, 35, 40, 45, 50, 55, 60, 70, 80
+};
+
+// SPI clocks tried by rampSpiClock()
+static const uint32_t rampClocks[] = {
+  1000000, 2000000, 4000000, 8000000, 10000000, 13000000,
+  16000000, 20000000, 25000000, 33000000, 40000000, 50000000
+};
+
+// read-backs of block zero per rampSpiClock() step
+#define RAMP_READ_COUNT 4
+
+// SD Status AU_SIZE codes 0XA to 0XF in 512 byte blocks, smaller
+// codes are 32 << (code - 1)
+static const uint32_t auBlocksTable[6] = {
+  16384, 24576, 32768, 49152, 65536, 131072
+};
+
+// SD Status SPEED_CLASS codes in MB/s
+static const uint8_t speedClassTable[5] = {0, 2, 4, 6, 10};
+
+// decode the CSD TRAN_SPEED field to a clock in Hz
+static uint32_t tranSpeedClock(uint8_t tranSpeed) 
+{
+  // units are 100 kbit/s, 1 Mbit/s, 10 Mbit/s and 100 Mbit/s
+  uint8_t unit = tranSpeed & 7;
+  if (unit > 3) return SD_DEFAULT_CLOCK;
+
+  uint32_t clock = 10000UL * tranSpeedValue[(tranSpeed >> 3) & 0XF];
+  while (unit--) clock *= 10;
+  return clock ? clock : SD_DEFAULT_CLOCK;
+}
+
+// release chip select and end the SPI transaction
+void SpiSd2Card::chipSelectHigh(void) 
+{
+  if (chipSelectPin_ != SD_CHIP_SELECT_AUTO) 
+    digitalWrite(chipSelectPin_, HIGH);
+
+  if (chipSelectAsserted_) {
+    chipSelectAsserted_ = 0;
+    spi_.endTransaction();
+  }
+}
+
+// begin an SPI transaction at the current clock and select the card
+void SpiSd2Card::chipSelectLow(void) 
+{
+  if (!chipSelectAsserted_) {
+    chipSelectAsserted_ = 1;
+    spi_.beginTransaction(settings);
+  }
+
+  if (chipSelectPin_ != SD_CHIP_SELECT_AUTO) 
+    digitalWrite(chipSelectPin_, LOW);
+}
+
 void SpiSd2Card::spiSend(uint8_t b) 
 {
+#if SPISD_BUS_STATS
+  busBytes_++;
+#endif  // SPISD_BUS_STATS
   spi_.transfer(b);
 }
 
 uint8_t SpiSd2Card::spiRec(void) 
 {
+#if SPISD_BUS_STATS
+  busBytes_++;
+#endif  // SPISD_BUS_STATS
   return spi_.transfer(0xFF);
 }
 
+// send a buffer with one transfer call per 512 bytes
+void SpiSd2Card::spiSend(const uint8_t* buf, size_t n) 
+{
+#if SPISD_BUS_STATS
+  busBytes_ += n;
+#endif  // SPISD_BUS_STATS
+  while (n) {
+    size_t k = n < sizeof(spiBuf) ? n : sizeof(spiBuf);
+    memcpy(spiBuf, buf, k);
+    spi_.transfer(spiBuf, k);
+    buf += k;
+    n -= k;
+  }
+}
+
+// clock out 0XFF and receive n bytes into buf
+void SpiSd2Card::spiRec(uint8_t* buf, size_t n) 
+{
+  if (n == 0) return;
+#if SPISD_BUS_STATS
+  busBytes_ += n;
+#endif  // SPISD_BUS_STATS
+  memset(buf, 0XFF, n);
+  spi_.transfer(buf, n);
+}
+
+// clock out 0XFF and discard n received bytes
+void SpiSd2Card::spiSkip(size_t n) 
+{
+  while (n) {
+    size_t k = n < sizeof(spiBuf) ? n : sizeof(spiBuf);
+    spiRec(spiBuf, k);
+    n -= k;
+  }
+}
+
+
+// finish an asynchronous operation and call its callback
+uint8_t SpiSd2Card::asyncFinish(uint8_t ok) 
+{
+  chipSelectHigh();
+  asyncState_ = ASYNC_IDLE;
+  asyncStatus_ = ok ? SD_ASYNC_DONE : SD_ASYNC_ERROR;
+  if (asyncCallback_) asyncCallback_(ok, asyncContext_);
+  return asyncStatus_;
+}
+
+/**
+ *  Advance the asynchronous operation in progress.
+ *
+ *  Each call checks the card once or sends one initialization command.
+ *  When the card is ready the block data is transferred, otherwise the
+ *  call returns at once so the caller can do other work while the card
+ *  initializes, reads, programs or erases flash.
+ *  The bus is released while the card programs flash but stays
+ *  selected until read data has arrived.
+ *  The completion callback, if any, is called from asyncPoll().
+ *
+ *  \return SD_ASYNC_PENDING while the operation is in progress,
+ *  SD_ASYNC_DONE if it completed or SD_ASYNC_ERROR if it failed.
+ */
+uint8_t SpiSd2Card::asyncPoll(void) 
+{
+  switch (asyncState_) {
+    case ASYNC_READ:
+    case ASYNC_READ_MULTI:
+      status_ = spiRec();
+      if (status_ == 0XFF) {
+        if ((millis() - asyncT0_) > asyncTimeout_) {
+          error(SD_CARD_ERROR_READ_TIMEOUT);
+          break;
+        }
+        return SD_ASYNC_PENDING;
+      }
+
+      if (status_ != DATA_START_BLOCK) {
+        error(SD_CARD_ERROR_READ);
+        break;
+      }
+
+      spiRec(asyncDst_, 512);
+      if (!readCrc(asyncDst_, 512)) 
+        break;
+      asyncDst_ += 512;
+
+      if (--asyncCount_) {
+        asyncT0_ = millis();
+        return SD_ASYNC_PENDING;
+      }
+
+      if (asyncState_ == ASYNC_READ_MULTI) {
+        asyncState_ = ASYNC_IDLE;
+        return asyncFinish(readStop());
+      }
+      return asyncFinish(true);
+
+    case ASYNC_WRITE:
+    case ASYNC_WRITE_DATA:
+    case ASYNC_WRITE_STOP:
+    case ASYNC_ERASE:
+      chipSelectLow();
+      if (spiRec() != 0XFF) {
+        if ((millis() - asyncT0_) > asyncTimeout_) {
+          switch (asyncState_) {
+            case ASYNC_WRITE: error(SD_CARD_ERROR_WRITE_TIMEOUT); break;
+            case ASYNC_WRITE_DATA: error(SD_CARD_ERROR_WRITE_MULTIPLE); break;
+            case ASYNC_WRITE_STOP: error(SD_CARD_ERROR_STOP_TRAN); break;
+            default: error(SD_CARD_ERROR_ERASE_TIMEOUT);
+          }
+          break;
+        }
+        chipSelectHigh();
+        return SD_ASYNC_PENDING;
+      }
+
+      // the card is ready for the stop token and then busy again
+      if (asyncState_ == ASYNC_WRITE_STOP && asyncCount_) {
+        asyncCount_ = 0;
+        spiSend(STOP_TRAN_TOKEN);
+        asyncT0_ = millis();
+        chipSelectHigh();
+        return SD_ASYNC_PENDING;
+      }
+
+      if (asyncState_ == ASYNC_WRITE || asyncState_ == ASYNC_WRITE_STOP) {
+        asyncState_ = ASYNC_IDLE;
+        return asyncFinish(writeStatus());
+      }
+      return asyncFinish(true);
+
+    case ASYNC_INIT_CMD0:
+    case ASYNC_INIT_ACMD41:
+      return initStep();
+
+    default:
+      return asyncStatus_;
+  }
+
+  // failed, end a read multiple blocks sequence
+  if (asyncState_ == ASYNC_READ_MULTI) {
+    asyncState_ = ASYNC_IDLE;
+    readStop();
+  }
+  return asyncFinish(false);
+}
+
+// start an asynchronous operation, the card command has been sent
+uint8_t SpiSd2Card::asyncStart(uint8_t state
+          ,SpiSdCallback callback, void* context) 
+{
+  asyncState_ = state;
+  asyncStatus_ = SD_ASYNC_PENDING;
+  asyncCallback_ = callback;
+  asyncContext_ = context;
+  asyncT0_ = millis();
+
+  switch (state) {
+    case ASYNC_READ:
+    case ASYNC_READ_MULTI:
+      asyncTimeout_ = info_.readTimeout; break;
+    case ASYNC_ERASE:
+      asyncTimeout_ = SD_ERASE_TIMEOUT; break;
+    case ASYNC_INIT_CMD0:
+    case ASYNC_INIT_ACMD41:
+      asyncTimeout_ = SD_INIT_TIMEOUT; break;
+    default:
+      asyncTimeout_ = info_.writeTimeout;
+  }
+  return true;
+}
+
+/**
+ *  Poll the asynchronous operation in progress until it completes.
+ *  \return The value one, true, is returned for success and
+ *  the value zero, false, is returned for failure.
+ */
+uint8_t SpiSd2Card::asyncWait(void) 
+{
+  uint8_t status;
+  while ((status = asyncPoll()) == SD_ASYNC_PENDING) ;
+  return status == SD_ASYNC_DONE;
+}
 
 // send command and return error code.  Return zero for OK
 uint8_t SpiSd2Card::cardCommand(uint8_t cmd, uint32_t arg) 
 {
+  uint8_t buf[6];
+
+  // complete an asynchronous operation before the next command
+  if (asyncState_) asyncWait();
+
+  // check a write-behind block, a failure is kept for writeFinish()
+  if (writePending_ && !writeCheck()) writeError_ = errorCode_;
+
   // end read if in partialBlockRead mode
   readEnd();
 
-  // wait up to 300 ms if busy
-  waitNotBusy(300);
+  // select card
+  chipSelectLow();
 
-  spiSend(cmd | 0x40);
+  buf[0] = cmd | 0x40;
+  for (uint8_t i = 1; i < 5; i++) buf[i] = arg >> (32 - 8*i);
+  buf[5] = SpiSdCrc7(buf, 5);
 
-  for (int8_t s = 24; s >= 0; s -= 8) spiSend(arg >> s);
+  for (uint8_t retry = 0; ; retry++) {
+    // wait up to 300 ms if busy, stop transmission can't wait for a
+    // card that is streaming read data.  Writes and erases have been
+    // completed by asyncPoll() above, so the card is normally ready at
+    // the first byte.  This guard stays a direct wait because the card
+    // is already selected for the command and its result is not used
+    if (cmd != CMD12) waitNotBusy(300);
 
-  uint8_t crc = 0XFF;
-  if (cmd == CMD0) crc = 0X95;  // correct crc for CMD0 with arg 0
-  if (cmd == CMD8) crc = 0X87;  // correct crc for CMD8 with arg 0X1AA
-  spiSend(crc);
+    spiSend(buf, 6);
 
-  // wait for response
-  for (uint8_t i = 0; ((status_ = spiRec()) & 0X80) && i != 0XFF; i++) ;
-  return status_;
+    // skip stuff byte for stop read
+    if (cmd == CMD12) spiRec();
+
+    // wait for response
+    for (uint8_t i = 0; ((status_ = spiRec()) & 0X80) && i != 0XFF; i++) ;
+
+    // send again if the card received a corrupted command
+    if (!(status_ & R1_COM_CRC_ERROR) || !crcRetry(retry)) 
+      return status_;
+  }
 }
 
 
@@ -65,14 +340,17 @@ uint8_t SpiSd2Card::cardAcmd(uint8_t cmd, uint32_t arg)
 }
 
 /**
- *  Determine the size of an SD flash memory card.
+ *  Determine the size of an SD flash memory card from the CSD read by init().
  *  \return The number of 512 byte data blocks in the card or zero 
- *  if an error occurs.
+ *  if init() has not succeeded or an error occurs.
  */
 uint32_t SpiSd2Card::cardSize(void) 
 {
-  csd_t csd;
-  if (!readCSD(&csd)) return 0;
+  // no CSD before a successful init()
+  if (!type_) 
+    return 0;
+
+  const csd_t& csd = csd_;
   if (csd.v1.csd_ver == 0) {
     uint8_t read_bl_len = csd.v1.read_bl_len;
     uint16_t c_size = (csd.v1.c_size_high << 10)
@@ -109,11 +387,43 @@ uint32_t SpiSd2Card::cardSize(void)
  */
 uint8_t SpiSd2Card::erase(uint32_t firstBlock, uint32_t lastBlock) 
 {
+  // wait for an operation in progress
+  if (asyncState_) asyncWait();
+  return eraseAsync(firstBlock, lastBlock) && asyncWait();
+}
+
+/**
+ *  Start erasing a range of blocks.
+ *
+ *  The erase commands are sent and the function returns.  asyncPoll()
+ *  checks once per call whether the card has finished.  The erase
+ *  timeout is computed from the card's SD Status, SD_ERASE_TIMEOUT is
+ *  used if the card does not report its erase parameters.
+ *
+ *  \param[in] firstBlock The address of the first block in the range.
+ *  \param[in] lastBlock The address of the last block in the range.
+ *  \param[in] callback Function called when the erase completes or zero.
+ *  \param[in] context Pointer passed to \a callback.
+ *  \return The value one, true, is returned if the erase was started and
+ *  the value zero, false, is returned for failure.
+ */
+uint8_t SpiSd2Card::eraseAsync(uint32_t firstBlock, uint32_t lastBlock
+          ,SpiSdCallback callback, void* context) 
+{
+  // don't disturb the operation in progress
+  if (asyncState_) {
+    error(SD_CARD_ERROR_ASYNC_BUSY);
+    return false;
+  }
+
+  uint32_t timeout;
+
   if (!eraseSingleBlockEnable()) {
     error(SD_CARD_ERROR_ERASE_SINGLE_BLOCK);
     goto fail;
   }
 
+  timeout = eraseTimeout(firstBlock, lastBlock);
   if (type_ != SD_CARD_TYPE_SDHC) {
     firstBlock <<= 9;
     lastBlock <<= 9;
@@ -126,17 +436,29 @@ uint8_t SpiSd2Card::erase(uint32_t firstBlock, uint32_t lastBlock)
       goto fail;
   }
 
-  if (!waitNotBusy(SD_ERASE_TIMEOUT)) {
-    error(SD_CARD_ERROR_ERASE_TIMEOUT);
-    goto fail;
-  }
-
+  // release the bus while the card erases
+  chipSelectHigh();
+  asyncStart(ASYNC_ERASE, callback, context);
+  asyncTimeout_ = timeout;
   return true;
 
 fail:
+  chipSelectHigh();
   return false;
 }
 
+// erase timeout in ms for a range of blocks from the SD Status fields
+uint32_t SpiSd2Card::eraseTimeout(uint32_t firstBlock
+          ,uint32_t lastBlock) const 
+{
+  if (!info_.auBlocks || !info_.eraseSize || !info_.eraseTimeout) 
+    return SD_ERASE_TIMEOUT;
+
+  uint32_t au = lastBlock/info_.auBlocks - firstBlock/info_.auBlocks + 1;
+  uint64_t ms = (uint64_t)1000*info_.eraseTimeout*au/info_.eraseSize;
+  return ms + 1000UL*info_.eraseOffset;
+}
+
 /**
  *  Determine if card supports single block erase.
  *  \return The value one, true, is returned if single block erase is supported.
@@ -144,64 +466,124 @@ fail:
  */
 uint8_t SpiSd2Card::eraseSingleBlockEnable(void) 
 {
-  csd_t csd;
-  return readCSD(&csd) ? csd.v1.erase_blk_en : 0;
+  return csd_.v1.erase_blk_en;
 }
 
 /**
  *  Initialize an SD flash memory card.
  *
+ *  The card is identified at SD_INIT_CLOCK, the clock selected by
+ *  \a sckRateID is used for all later transfers.
+ *
  *  \param[in] sckRateID SPI clock rate selector. See setSckRate().
- *  \param[in] chipSelectPin SD chip select pin number.
+ *  \param[in] chipSelectPin SD chip select pin number or
+ *  SD_CHIP_SELECT_AUTO if the SPI controller drives chip select.
  *  \return The value one, true, is returned for success and
  *  the value zero, false, is returned for failure.  The reason for failure
  *  can be determined by calling errorCode() and errorData(). 
  */
-uint8_t SpiSd2Card::init(uint8_t sckRateID) 
+uint8_t SpiSd2Card::init(uint8_t sckRateID, uint8_t chipSelectPin) 
 {
-  errorCode_ = inBlock_ = partialBlockRead_ = type_ = 0;
+  return initAsync(sckRateID, chipSelectPin) && asyncWait();
+}
 
-  uint16_t t0 = (uint16_t)millis();
-  uint32_t arg;
+/**
+ *  Start initialization of an SD flash memory card.
+ *
+ *  The card is reset and the function returns.  asyncPoll() sends one
+ *  identification command per call until the card is ready, then
+ *  reads its registers and selects the data clock.
+ *
+ *  \param[in] sckRateID SPI clock rate selector. See setSckRate().
+ *  \param[in] chipSelectPin SD chip select pin number or
+ *  SD_CHIP_SELECT_AUTO if the SPI controller drives chip select.
+ *  \param[in] callback Function called when initialization completes or zero.
+ *  \param[in] context Pointer passed to \a callback.
+ *  \return The value one, true, is returned if initialization was started.
+ */
+uint8_t SpiSd2Card::initAsync(uint8_t sckRateID, uint8_t chipSelectPin
+          ,SpiSdCallback callback, void* context) 
+{
+  // end a transaction left open by an earlier use of the card
+  chipSelectHigh();
+
+  errorCode_ = inBlock_ = partialBlockRead_ = type_ = asyncState_ = 0;
+  highSpeed_ = statusPending_ = writePending_ = writeError_ = 0;
+  chipSelectPin_ = chipSelectPin;
+  spiClock_ = SD_INIT_CLOCK;
+
+  memset(&info_, 0, sizeof(info_));
+  info_.readTimeout = SD_READ_TIMEOUT;
+  info_.writeTimeout = SD_WRITE_TIMEOUT;
+
+  // set pin modes
+  if (chipSelectPin_ != SD_CHIP_SELECT_AUTO) {
+    pinMode(chipSelectPin_, OUTPUT);
+    digitalWrite(chipSelectPin_, HIGH);
+  }
 
   spi_.begin();
-  settings = SPISettings(250000, MSBFIRST, SPI_MODE0);
+  settings = SPISettings(SD_INIT_CLOCK, MSBFIRST, SPI_MODE0);
 
   // must supply min of 74 clock cycles with CS high.
   spi_.beginTransaction(settings);
   for (uint8_t i = 0; i < 10; i++) spiSend(0XFF);
   spi_.endTransaction();
 
-  // command to go idle in SPI mode
-  while ((status_ = cardCommand(CMD0, 0)) != R1_IDLE_STATE) {
-    if (((uint16_t)(millis() - t0)) > SD_INIT_TIMEOUT) {
-      error(SD_CARD_ERROR_CMD0);
-      goto fail;
+  asyncCount_ = sckRateID;
+  return asyncStart(ASYNC_INIT_CMD0, callback, context);
+}
+
+// one step of initialization, called by asyncPoll()
+uint8_t SpiSd2Card::initStep(void) 
+{
+  uint8_t state = asyncState_;
+  uint32_t arg;
+
+  // commands below belong to this operation and must not wait for it
+  asyncState_ = ASYNC_IDLE;
+
+  if (state == ASYNC_INIT_CMD0) {
+    // command to go idle in SPI mode
+    if ((status_ = cardCommand(CMD0, 0)) != R1_IDLE_STATE) {
+      if ((millis() - asyncT0_) > asyncTimeout_) {
+        error(SD_CARD_ERROR_CMD0);
+        goto fail;
+      }
+      goto pending;
     }
-  }
 
-  // check SD version
-  if ((cardCommand(CMD8, 0x1AA) & R1_ILLEGAL_COMMAND)) {
-    type(SD_CARD_TYPE_SD1);
-  } else {
-    // only need last byte of r7 response
-    for (uint8_t i = 0; i < 4; i++) status_ = spiRec();
-    if (status_ != 0XAA) {
-      error(SD_CARD_ERROR_CMD8);
+    // check SD version
+    if ((cardCommand(CMD8, 0x1AA) & R1_ILLEGAL_COMMAND)) {
+      type(SD_CARD_TYPE_SD1);
+    } else {
+      // only need last byte of r7 response
+      for (uint8_t i = 0; i < 4; i++) status_ = spiRec();
+      if (status_ != 0XAA) {
+        error(SD_CARD_ERROR_CMD8);
+        goto fail;
+      }
+      type(SD_CARD_TYPE_SD2);
+    }
+
+    if (crc_ && cardCommand(CMD59, 1) > R1_IDLE_STATE) {
+      error(SD_CARD_ERROR_CMD59);
       goto fail;
     }
-    type(SD_CARD_TYPE_SD2);
+    state = ASYNC_INIT_ACMD41;
+    goto pending;
   }
 
   // initialize card and send host supports SDHC if SD2
   arg = type() == SD_CARD_TYPE_SD2 ? 0X40000000 : 0;
 
-  while ((status_ = cardAcmd(ACMD41, arg)) != R1_READY_STATE) {
+  if ((status_ = cardAcmd(ACMD41, arg)) != R1_READY_STATE) {
     // check for timeout
-    if (((uint16_t)(millis() - t0)) > SD_INIT_TIMEOUT) {
+    if ((millis() - asyncT0_) > asyncTimeout_) {
       error(SD_CARD_ERROR_ACMD41);
       goto fail;
     }
+    goto pending;
   }
 
   // if SD2 read OCR register to check for SDHC card
@@ -215,10 +597,37 @@ uint8_t SpiSd2Card::init(uint8_t sckRateID)
     for (uint8_t i = 0; i < 3; i++) spiRec();
   }
 
-  return setSckRate(sckRateID);
+  // keep CID and CSD for later queries
+  if (!readRegister(CMD10, &cid_) || !readRegister(CMD9, &csd_)) 
+    goto fail;
+
+  // rated clock, cards supporting command class 10 may switch to
+  // high speed mode which raises TRAN_SPEED
+  if (csd_.v1.ccc_high & 0X40) {
+    if (switchHighSpeed()) {
+      highSpeed_ = 1;
+      if (!readRegister(CMD9, &csd_)) goto fail;
+    } else {
+      // the card stays in default speed mode
+      errorCode_ = 0;
+    }
+  }
+  maxClock_ = tranSpeedClock(csd_.v1.tran_speed);
+  readInfo();
+
+  return asyncFinish(setSckRate(asyncCount_));
+
+pending:
+  chipSelectHigh();
+  asyncState_ = state;
+  return SD_ASYNC_PENDING;
 
 fail:
-  return false;
+  // the card is not identified, don't report stale registers
+  type_ = 0;
+  memset(&cid_, 0, sizeof(cid_));
+  memset(&csd_, 0, sizeof(csd_));
+  return asyncFinish(false);
 }
 
 /**
@@ -249,9 +658,97 @@ void SpiSd2Card::partialBlockRead(uint8_t value)
  */
 uint8_t SpiSd2Card::readBlock(uint32_t block, uint8_t* dst) 
 {
-  return readData(block, 0, 512, dst);
+  // wait for an operation in progress
+  if (asyncState_) asyncWait();
+
+  for (uint8_t retry = 0; ; retry++) {
+    if (readBlocksAsync(block, 1, dst) && asyncWait()) return true;
+    if (!crcRetry(retry)) return false;
+  }
 }
 
+/**
+ *  Read a range of 512 byte blocks from an SD card with one
+ *  READ_MULTIPLE_BLOCK command.
+ *
+ *  \param[in] block Logical block of the first block to be read.
+ *  \param[in] count Number of blocks to read.
+ *  \param[out] dst Pointer to the location that will receive the data.
+ *  It must have room for \a count * 512 bytes.
+ *  \return The value one, true, is returned for success and
+ *  the value zero, false, is returned for failure.
+ */
+uint8_t SpiSd2Card::readBlocks(uint32_t block, uint32_t count, uint8_t* dst) 
+{
+  if (count == 0) return true;
+  if (count == 1) return readBlock(block, dst);
+
+  // wait for an operation in progress
+  if (asyncState_) asyncWait();
+
+  for (uint8_t retry = 0; ; retry++) {
+    if (readBlocksAsync(block, count, dst) && asyncWait()) return true;
+    if (!crcRetry(retry)) return false;
+
+    // continue with the block that failed, all blocks are read again
+    // if the stop command failed
+    if (asyncCount_) {
+      uint32_t done = count - asyncCount_;
+      block += done;
+      dst += 512*done;
+      count = asyncCount_;
+    }
+  }
+}
+
+/**
+ *  Start an asynchronous read of a range of 512 byte blocks.
+ *
+ *  The read command is sent and the function returns.  Data is
+ *  transferred by asyncPoll() as each block becomes ready.
+ *
+ *  \param[in] block Logical block of the first block to be read.
+ *  \param[in] count Number of blocks to read.
+ *  \param[out] dst Pointer to the location that will receive the data.
+ *  It must stay valid until the operation completes.
+ *  \param[in] callback Function called when the read completes or zero.
+ *  \param[in] context Pointer passed to \a callback.
+ *  \return The value one, true, is returned if the read was started and
+ *  the value zero, false, is returned for failure.
+ */
+uint8_t SpiSd2Card::readBlocksAsync(uint32_t block, uint32_t count
+          ,uint8_t* dst, SpiSdCallback callback, void* context) 
+{
+  uint8_t cmd = count == 1 ? CMD17 : CMD18;
+
+  // don't disturb the operation in progress
+  if (asyncState_) {
+    error(SD_CARD_ERROR_ASYNC_BUSY);
+    return false;
+  }
+
+  if (count == 0) 
+    return false;
+
+  // use address if not SDHC card
+  if (type() != SD_CARD_TYPE_SDHC) 
+    block <<= 9;
+
+  asyncDst_ = dst;
+  asyncCount_ = count;
+  if (cardCommand(cmd, block)) {
+    error(cmd == CMD17 ? SD_CARD_ERROR_CMD17 : SD_CARD_ERROR_CMD18);
+    goto fail;
+  }
+
+  // the card stays selected until the data has been read
+  return asyncStart(cmd == CMD17 ? ASYNC_READ : ASYNC_READ_MULTI
+                      ,callback, context);
+
+fail:
+  chipSelectHigh();
+  return false;
+}
 
 /**
  *  Read part of a 512 byte block from an SD card.
@@ -267,9 +764,8 @@ uint8_t SpiSd2Card::readData(uint32_t block
           ,uint16_t offset, uint16_t count, uint8_t* dst) 
 {
   if (count == 0) return true;
-  if ((count + offset) > 512) {
-    goto fail;
-  }
+  if ((count + offset) > 512) 
+    return false;
 
   if (!inBlock_ || block != block_ || offset < offset_) {
     block_ = block;
@@ -282,6 +778,9 @@ uint8_t SpiSd2Card::readData(uint32_t block
       goto fail;
     }
 
+    // a partial read leaves the card selected in the middle of the
+    // block, so it waits here instead of in asyncPoll(), which reads
+    // the whole block and releases the card
     if (!waitStartBlock()) {
       goto fail;
     }
@@ -291,11 +790,21 @@ uint8_t SpiSd2Card::readData(uint32_t block
   }
 
   // skip data before offset
-  for (;offset_ < offset; offset_++) 
-    spiRec();
+  if (offset_ < offset) {
+    spiSkip(offset - offset_);
+    offset_ = offset;
+  }
+
+  spiRec(dst, count);
 
-  for (uint16_t i = 0; i < count; i++) 
-    dst[i] = spiRec();
+  // a whole block read at once can be checked against its crc
+  if (offset == 0 && count == 512) {
+    inBlock_ = 0;
+    if (!readCrc(dst, 512)) 
+      goto fail;
+    chipSelectHigh();
+    return true;
+  }
 
   offset_ += count;
   if (!partialBlockRead_ || offset_ >= 512) 
@@ -304,20 +813,243 @@ uint8_t SpiSd2Card::readData(uint32_t block
   return true;
 
 fail:
+  chipSelectHigh();
   return false;
 }
 
+/**
+ *  Read the next block of a read multiple blocks sequence.
+ *
+ *  \param[out] dst Pointer to the location that will receive the data.
+ *  \note This function is used with readStart() and readStop() to
+ *  stream blocks without a buffer for the whole range.
+ *  \return The value one, true, is returned for success and
+ *  the value zero, false, is returned for failure.
+ */
+uint8_t SpiSd2Card::readData(uint8_t* dst) 
+{
+  // complete an asynchronous operation
+  if (asyncState_ && !asyncWait()) 
+    return false;
+
+  // asyncPoll() reads the block, the card stays selected until it has
+  chipSelectLow();
+  asyncDst_ = dst;
+  asyncCount_ = 1;
+  return asyncStart(ASYNC_READ, 0, 0) && asyncWait();
+}
+
+// read the data block of the SCR or the SD Status
+uint8_t SpiSd2Card::readAppRegister(uint8_t acmd, uint8_t* dst
+          ,uint16_t count) 
+{
+  if (cardAcmd(acmd, 0)) {
+    error(SD_CARD_ERROR_READ_REG);
+    goto fail;
+  }
+  // SD_STATUS has an R2 response
+  if (acmd == ACMD13 && spiRec()) {
+    error(SD_CARD_ERROR_READ_REG);
+    goto fail;
+  }
+
+  if (!waitStartBlock()) 
+    goto fail;
+  spiRec(dst, count);
+  if (!readCrc(dst, count)) 
+    goto fail;
+  chipSelectHigh();
+  return true;
+
+fail:
+  chipSelectHigh();
+  return false;
+}
+
+// receive the crc of a data block and check it in crc mode
+uint8_t SpiSd2Card::readCrc(const uint8_t* data, uint16_t count) 
+{
+  uint16_t crc = spiRec() << 8;
+  crc |= spiRec();
+  if (crc_ && crc != SpiSdCrc16(data, count)) {
+    error(SD_CARD_ERROR_READ_CRC);
+    return false;
+  }
+  return true;
+}
+
 /** Skip remaining data in a block when in partial block read mode. */
 void SpiSd2Card::readEnd(void) 
 {
   if (inBlock_) {
     // skip data and crc
-    while (offset_++ < 514) 
-      spiRec();
+    spiSkip(514 - offset_);
+    chipSelectHigh();
     inBlock_ = 0;
   }
 }
 
+/** 
+ *  Start a read multiple blocks sequence.
+ * 
+ *  \param[in] blockNumber Address of first block in sequence.
+ *  \note This function is used with readData() and readStop().
+ *  \return The value one, true, is returned for success and
+ *  the value zero, false, is returned for failure.
+ */
+uint8_t SpiSd2Card::readStart(uint32_t blockNumber) 
+{
+  // use address if not SDHC card
+  if (type() != SD_CARD_TYPE_SDHC) 
+    blockNumber <<= 9;
+
+  if (cardCommand(CMD18, blockNumber)) {
+    error(SD_CARD_ERROR_CMD18);
+    chipSelectHigh();
+    return false;
+  }
+  chipSelectHigh();
+  return true;
+}
+
+/** End a read multiple blocks sequence */
+uint8_t SpiSd2Card::readStop(void) 
+{
+  if (cardCommand(CMD12, 0)) {
+    error(SD_CARD_ERROR_CMD12);
+    chipSelectHigh();
+    return false;
+  }
+  chipSelectHigh();
+  return true;
+}
+
+// read block zero and checksum its data
+uint8_t SpiSd2Card::readCheck(uint32_t* sum) 
+{
+  if (cardCommand(CMD17, 0)) {
+    error(SD_CARD_ERROR_CMD17);
+    goto fail;
+  }
+  if (!waitStartBlock()) 
+    goto fail;
+
+  spiRec(spiBuf, 512);
+  *sum = 0;
+  for (uint16_t i = 0; i < 512; i++) {
+    *sum = ((*sum << 1) | (*sum >> 31)) + spiBuf[i];
+  }
+  if (!readCrc(spiBuf, 512)) 
+    goto fail;
+  chipSelectHigh();
+  return true;
+
+fail:
+  chipSelectHigh();
+  return false;
+}
+
+/**
+ *  Raise the SPI clock step by step up to the card's rated clock.
+ *
+ *  Block zero is read at the current clock as a reference and read
+ *  again at each higher step.  The clock stays at the last step whose
+ *  reads matched the reference, a failed or different read ends the ramp.
+ *
+ *  \param[in] limit The highest SPI clock in Hz to try or zero for the
+ *  card's rated clock, see maxClock().
+ *  \return The value one, true, is returned for success and
+ *  the value zero, false, is returned if the reference read fails.
+ */
+uint8_t SpiSd2Card::rampSpiClock(uint32_t limit) 
+{
+  uint32_t ref;
+  uint32_t sum;
+
+  if (limit == 0 || limit > maxClock_) limit = maxClock_;
+  if (spiClock_ > limit) setSpiClock(limit);
+  if (!readCheck(&ref)) return false;
+
+  uint32_t good = spiClock_;
+  for (uint8_t i = 0; i < sizeof(rampClocks)/sizeof(rampClocks[0]); i++) {
+    uint32_t clock = rampClocks[i] < limit ? rampClocks[i] : limit;
+    if (clock <= good) continue;
+
+    setSpiClock(clock);
+    uint8_t n;
+    for (n = 0; n < RAMP_READ_COUNT; n++) {
+      if (!readCheck(&sum) || sum != ref) break;
+    }
+    if (n < RAMP_READ_COUNT) break;
+    good = clock;
+  }
+
+  // fall back to the last clock that passed
+  errorCode_ = 0;
+  return setSpiClock(good);
+}
+
+// read the R2 card status, the error bits are cleared by the read
+uint8_t SpiSd2Card::readStatus(void) 
+{
+  statusPending_ = 0;
+
+  // response is r2 so get and check two bytes for nonzero
+  if (cardCommand(CMD13, 0) || spiRec()) {
+    error(SD_CARD_ERROR_WRITE_PROGRAMMING);
+    return false;
+  }
+  return true;
+}
+
+// derive timeouts from the CSD, read and decode SCR and SD Status
+void SpiSd2Card::readInfo(void) 
+{
+  const csd_t* csd = &csd_;
+
+  if (csd->v1.csd_ver == 0) {
+    // 100 times the access time TAAC + NSAC, at most 100 ms and
+    // R2W_FACTOR times that for writes, at most 250 ms
+    uint8_t unit = csd->v1.taac & 7;
+    uint32_t ns = tranSpeedValue[(csd->v1.taac >> 3) & 0XF];
+    while (unit--) ns *= 10;
+    ns /= 10;
+    uint32_t us = ns/1000 + 100UL*csd->v1.nsac/(maxClock_/1000000 + 1) + 1;
+    uint32_t ms = us/10 + 1;
+    info_.readTimeout = ms < 100 ? ms : 100;
+    ms <<= csd->v1.r2w_factor;
+    info_.writeTimeout = ms < 250 ? ms : 250;
+  } else {
+    // fixed for SDHC, SDXC cards above 32 GB may take 500 ms to write
+    info_.readTimeout = 100;
+    info_.writeTimeout = csd->v2.c_size_high ? 500 : 250;
+  }
+
+  if (readAppRegister(ACMD51, info_.scr, 8)) {
+    uint8_t spec = info_.scr[0] & 0XF;
+    info_.sdSpec = spec == 0 ? 10 : spec == 1 ? 11 : 20;
+    if (spec == 2 && (info_.scr[2] & 0X80)) 
+      info_.sdSpec = info_.scr[2] & 0X04 ? 40 : 30;
+  }
+
+  if (readAppRegister(ACMD13, info_.sdStatus, 64)) {
+    uint8_t* st = info_.sdStatus;
+    uint8_t au = st[10] >> 4;
+    if (st[8] < sizeof(speedClassTable)) 
+      info_.speedClass = speedClassTable[st[8]];
+    info_.uhsGrade = st[14] >> 4;
+    info_.videoClass = st[15];
+    info_.auBlocks = au == 0 ? 0 : au < 0XA ? 32UL << (au - 1) 
+                                 : auBlocksTable[au - 0XA];
+    info_.eraseSize = (st[11] << 8) | st[12];
+    info_.eraseTimeout = st[13] >> 2;
+    info_.eraseOffset = st[13] & 3;
+  }
+
+  // the card works without them
+  errorCode_ = 0;
+}
+
 /** read CID or CSR register */
 uint8_t SpiSd2Card::readRegister(uint8_t cmd, void* buf) 
 {
@@ -330,17 +1062,47 @@ uint8_t SpiSd2Card::readRegister(uint8_t cmd, void* buf)
   if (!waitStartBlock()) 
     goto fail;
   // transfer data
-  for (uint16_t i = 0; i < 16; i++) 
-    dst[i] = spiRec();
-
-  spiRec();  // get first crc byte
-  spiRec();  // get second crc byte
+  spiRec(dst, 16);
+  if (!readCrc(dst, 16)) 
+    goto fail;
+  chipSelectHigh();
   return true;
 
 fail:
+  chipSelectHigh();
   return false;
 }
 
+/**
+ *  Turn CRC protection of commands and data on or off.
+ *
+ *  With CRC on, the card rejects corrupted commands and write data, and
+ *  read data is checked against its CRC16.  A failed block transfer is
+ *  retried up to SD_CRC_RETRIES times, so a marginal bus can run at a
+ *  high clock.  May be called before init(), which then sends CMD59.
+ *
+ *  \param[in] value The value TRUE (non-zero) or FALSE (zero).
+ *  \return The value one, true, is returned for success and
+ *  the value zero, false, is returned for failure.
+ */
+uint8_t SpiSd2Card::useCrc(uint8_t value) 
+{
+  crc_ = value ? 1 : 0;
+
+  // applied by init() if the card is not initialized
+  if (!type_) 
+    return true;
+
+  if (cardCommand(CMD59, crc_)) {
+    error(SD_CARD_ERROR_CMD59);
+    chipSelectHigh();
+    crc_ = 0;
+    return false;
+  }
+  chipSelectHigh();
+  return true;
+}
+
 /**
  *  Set the SPI clock rate.
  *
@@ -359,25 +1121,67 @@ uint8_t SpiSd2Card::setSckRate(uint8_t sckRateID)
   }
 
   switch (sckRateID) {
-    case 0:  settings = SPISettings(25000000, MSBFIRST, SPI_MODE0); break;
-    case 1:  settings = SPISettings(4000000, MSBFIRST, SPI_MODE0); break;
-    case 2:  settings = SPISettings(2000000, MSBFIRST, SPI_MODE0); break;
-    case 3:  settings = SPISettings(1000000, MSBFIRST, SPI_MODE0); break;
-    case 4:  settings = SPISettings(500000, MSBFIRST, SPI_MODE0); break;
-    case 5:  settings = SPISettings(250000, MSBFIRST, SPI_MODE0); break;
-    default: settings = SPISettings(125000, MSBFIRST, SPI_MODE0);
+    case 0:  return setSpiClock(25000000);
+    case 1:  return setSpiClock(4000000);
+    case 2:  return setSpiClock(2000000);
+    case 3:  return setSpiClock(1000000);
+    case 4:  return setSpiClock(500000);
+    case 5:  return setSpiClock(250000);
+    default: return setSpiClock(125000);
   }
-
-  return true;
 }
 
 
+/**
+ *  Set the SPI clock frequency for data transfers.
+ *
+ *  \param[in] clock The SPI clock in Hz.  It is used from the next
+ *  transaction on.
+ *  \return The value one, true, is returned.
+ */
 uint8_t SpiSd2Card::setSpiClock(uint32_t clock)
 {
+  spiClock_ = clock;
   settings = SPISettings(clock, MSBFIRST, SPI_MODE0);
   return true;
 }
 
+// send SWITCH_FUNC and read the 64 byte switch status
+uint8_t SpiSd2Card::switchFunction(uint32_t arg, uint8_t* status) 
+{
+  if (cardCommand(CMD6, arg)) {
+    error(SD_CARD_ERROR_CMD6);
+    goto fail;
+  }
+  if (!waitStartBlock()) 
+    goto fail;
+
+  spiRec(status, 64);
+  if (!readCrc(status, 64)) 
+    goto fail;
+  chipSelectHigh();
+  return true;
+
+fail:
+  chipSelectHigh();
+  return false;
+}
+
+// select high speed, function one of group one, if the card supports it
+uint8_t SpiSd2Card::switchHighSpeed(void) 
+{
+  uint8_t status[64];
+
+  // mode 0 checks the function, support bits are in byte 13
+  if (!switchFunction(0X00FFFFF1, status) || !(status[13] & 2)) 
+    return false;
+
+  // mode 1 switches, byte 16 returns the selected function
+  if (!switchFunction(0X80FFFFF1, status)) 
+    return false;
+  return (status[16] & 0XF) == 1;
+}
+
 // wait for card to go not busy
 uint8_t SpiSd2Card::waitNotBusy(uint16_t timeoutMillis) 
 {
@@ -394,7 +1198,7 @@ uint8_t SpiSd2Card::waitStartBlock(void)
 {
   uint16_t t0 = millis();
   while ((status_ = spiRec()) == 0XFF) {
-    if (((uint16_t)millis() - t0) > SD_READ_TIMEOUT) {
+    if (((uint16_t)millis() - t0) > info_.readTimeout) {
       error(SD_CARD_ERROR_READ_TIMEOUT);
       goto fail;
     }
@@ -429,58 +1233,235 @@ uint8_t SpiSd2Card::writeBlock(uint32_t blockNumber, const uint8_t* src)
 
   // use address if not SDHC card
   if (type() != SD_CARD_TYPE_SDHC) blockNumber <<= 9;
-  if (cardCommand(CMD24, blockNumber)) {
-    error(SD_CARD_ERROR_CMD24);
-    goto fail;
+
+  for (uint8_t retry = 0; ; retry++) {
+    if (cardCommand(CMD24, blockNumber)) {
+      error(SD_CARD_ERROR_CMD24);
+    } else if (writeData(DATA_START_BLOCK, src)) {
+      break;
+    }
+    if (!crcRetry(retry)) 
+      goto fail;
   }
 
-  if (!writeData(DATA_START_BLOCK, src)) 
-    goto fail;
+  // in write-behind mode the next command waits for programming
+  writePending_ = 1;
+  if (writeBehind_) {
+    chipSelectHigh();
+    return true;
+  }
+  return writeCheck();
+
+fail:
+  chipSelectHigh();
+  return false;
+}
+
+// wait for flash programming of a single block write and check status
+uint8_t SpiSd2Card::writeCheck(void) 
+{
+  writePending_ = 0;
+
+  // asyncPoll() waits for programming and checks status
+  return asyncStart(ASYNC_WRITE, 0, 0) && asyncWait();
+}
+
+// check card status now or at writeFinish() as selected by statusCheck()
+uint8_t SpiSd2Card::writeStatus(void) 
+{
+  if (statusCheck_ == SD_STATUS_CHECK_ALWAYS) 
+    return readStatus();
+
+  if (statusCheck_ == SD_STATUS_CHECK_SYNC) 
+    statusPending_ = 1;
+  return true;
+}
+
+/**
+ *  Complete writes whose checks were deferred.
+ *
+ *  Waits for the card to program a block written in write-behind mode
+ *  and reads card status if SD_STATUS_CHECK_SYNC deferred it.  An error
+ *  found while the next command was started is reported here as well.
+ *
+ *  \return The value one, true, is returned for success and
+ *  the value zero, false, is returned for failure.
+ */
+uint8_t SpiSd2Card::writeFinish(void) 
+{
+  if (writePending_ && !writeCheck()) 
+    writeError_ = errorCode_;
 
-  // wait for flash programming to complete
-  if (!waitNotBusy(SD_WRITE_TIMEOUT)) {
-    error(SD_CARD_ERROR_WRITE_TIMEOUT);
+  if (statusPending_) {
+    if (!readStatus()) writeError_ = errorCode_;
+    chipSelectHigh();
+  }
+
+  if (writeError_) {
+    error(writeError_);
+    writeError_ = 0;
+    return false;
+  }
+  return true;
+}
+
+/**
+ *  Writes a range of 512 byte blocks to an SD card with one
+ *  WRITE_MULTIPLE_BLOCK command.  The card is told to pre-erase
+ *  \a count blocks before the data is sent.
+ *
+ *  \param[in] blockNumber Logical block of the first block to be written.
+ *  \param[in] count Number of blocks to write.
+ *  \param[in] src Pointer to the location of the data to be written.
+ *  \return The value one, true, is returned for success and
+ *  the value zero, false, is returned for failure.
+ */
+uint8_t SpiSd2Card::writeBlocks(uint32_t blockNumber
+          ,uint32_t count, const uint8_t* src) 
+{
+  if (count == 0) return true;
+  if (count == 1) return writeBlock(blockNumber, src);
+
+  for (uint8_t retry = 0; ; retry++) {
+    if (writeStart(blockNumber, count)) {
+      uint32_t n;
+      for (n = 0; n < count; n++) {
+        if (!writeData(src + 512*n)) break;
+      }
+      // a failed block keeps its error code
+      uint8_t code = errorCode_;
+      if (writeStop() && n == count) return true;
+      if (n < count) error(code);
+    }
+    if (!crcRetry(retry)) return false;
+  }
+}
+
+/**
+ *  Start an asynchronous write of a 512 byte block.
+ *
+ *  The block is sent to the card and the function returns while the
+ *  card programs flash.  asyncPoll() completes the write.
+ *
+ *  \param[in] blockNumber Logical block to be written.
+ *  \param[in] src Pointer to the location of the data to be written.
+ *  \param[in] callback Function called when the write completes or zero.
+ *  \param[in] context Pointer passed to \a callback.
+ *  \return The value one, true, is returned if the write was started and
+ *  the value zero, false, is returned for failure.
+ */
+uint8_t SpiSd2Card::writeBlockAsync(uint32_t blockNumber
+          ,const uint8_t* src, SpiSdCallback callback, void* context) 
+{
+  // don't disturb the operation in progress
+  if (asyncState_) {
+    error(SD_CARD_ERROR_ASYNC_BUSY);
+    return false;
+  }
+
+  // don't allow write to first block
+  if (blockNumber == 0) {
+    error(SD_CARD_ERROR_WRITE_BLOCK_ZERO);
     goto fail;
   }
 
-  // response is r2 so get and check two bytes for nonzero
-  if (cardCommand(CMD13, 0) || spiRec()) {
-    error(SD_CARD_ERROR_WRITE_PROGRAMMING);
+  // use address if not SDHC card
+  if (type() != SD_CARD_TYPE_SDHC) blockNumber <<= 9;
+  if (cardCommand(CMD24, blockNumber)) {
+    error(SD_CARD_ERROR_CMD24);
     goto fail;
   }
 
-  return true;
+  if (!writeData(DATA_START_BLOCK, src)) 
+    goto fail;
+
+  // release the bus while the card programs flash
+  chipSelectHigh();
+  return asyncStart(ASYNC_WRITE, callback, context);
 
 fail:
+  chipSelectHigh();
   return false;
 }
 
 /** Write one data block in a multiple block write sequence */
 uint8_t SpiSd2Card::writeData(const uint8_t* src) 
 {
+  // complete an asynchronous block
+  if (asyncState_ && !asyncWait()) 
+    return false;
+
   // wait for previous write to finish
-  if (!waitNotBusy(SD_WRITE_TIMEOUT)) {
-    error(SD_CARD_ERROR_WRITE_MULTIPLE);
+  if (!asyncStart(ASYNC_WRITE_DATA, 0, 0) || !asyncWait()) 
+    return false;
+
+  chipSelectLow();
+  if (!writeData(WRITE_MULTIPLE_TOKEN, src)) 
+    goto fail;
+
+  chipSelectHigh();
+  return true;
+
+fail:
+  chipSelectHigh();
+  return false;
+}
+
+/**
+ *  Start an asynchronous write of one data block in a multiple block
+ *  write sequence started by writeStart().  The function returns while
+ *  the card programs flash.  asyncPoll() completes the write.
+ *
+ *  \param[in] src Pointer to the location of the data to be written.
+ *  \param[in] callback Function called when the write completes or zero.
+ *  \param[in] context Pointer passed to \a callback.
+ *  \return The value one, true, is returned if the write was started and
+ *  the value zero, false, is returned for failure.
+ */
+uint8_t SpiSd2Card::writeDataAsync(const uint8_t* src
+          ,SpiSdCallback callback, void* context) 
+{
+  // don't disturb the operation in progress
+  if (asyncState_) {
+    error(SD_CARD_ERROR_ASYNC_BUSY);
     return false;
   }
-  return writeData(WRITE_MULTIPLE_TOKEN, src);
+
+  chipSelectLow();
+
+  // wait for a previous blocking write to finish
+  if (!waitNotBusy(info_.writeTimeout)) {
+    error(SD_CARD_ERROR_WRITE_MULTIPLE);
+    goto fail;
+  }
+
+  if (!writeData(WRITE_MULTIPLE_TOKEN, src)) 
+    goto fail;
+
+  // release the bus while the card programs flash
+  chipSelectHigh();
+  return asyncStart(ASYNC_WRITE_DATA, callback, context);
+
+fail:
+  chipSelectHigh();
+  return false;
 }
 
 // send one block of data for write block or write multiple blocks
 uint8_t SpiSd2Card::writeData(uint8_t token, const uint8_t* src) 
 {
-  spiSend(token);
+  uint16_t crc = crc_ ? SpiSdCrc16(src, 512) : 0XFFFF;
 
-  for (uint16_t i = 0; i < 512; i++)  {
-    spiSend(src[i]);
-  }
+  spiSend(token);
+  spiSend(src, 512);
 
-  spiSend(0xff);  // dummy crc
-  spiSend(0xff);  // dummy crc
+  spiSend(crc >> 8);
+  spiSend(crc & 0XFF);
 
   status_ = spiRec();
   if ((status_ & DATA_RES_MASK) != DATA_RES_ACCEPTED) {
-    error(SD_CARD_ERROR_WRITE);
+    error((status_ & DATA_RES_MASK) == DATA_RES_CRC_ERROR ?
+            SD_CARD_ERROR_WRITE_CRC : SD_CARD_ERROR_WRITE);
     return false;
   }
 
@@ -520,9 +1501,11 @@ uint8_t SpiSd2Card::writeStart(uint32_t blockNumber, uint32_t eraseCount)
     goto fail;
   }
 
+  chipSelectHigh();
   return true;
 
 fail:
+  chipSelectHigh();
   return false;
 }
 
@@ -533,16 +1516,32 @@ fail:
  */
 uint8_t SpiSd2Card::writeStop(void) 
 {
-  if (!waitNotBusy(SD_WRITE_TIMEOUT)) 
-    goto fail;
+  // complete an asynchronous block
+  if (asyncState_ && !asyncWait()) 
+    return false;
 
-  spiSend(STOP_TRAN_TOKEN);
-  if (!waitNotBusy(SD_WRITE_TIMEOUT)) 
-    goto fail;
+  return writeStopAsync() && asyncWait();
+}
 
-  return true;
+/** 
+ *  Start ending a write multiple blocks sequence.  asyncPoll() sends
+ *  the stop token when the card is ready and completes when the card
+ *  has programmed the last block.
+ *
+ *  \param[in] callback Function called when the sequence has ended or zero.
+ *  \param[in] context Pointer passed to \a callback.
+ *  \return The value one, true, is returned if the stop was started and
+ *  the value zero, false, is returned for failure.
+ */
+uint8_t SpiSd2Card::writeStopAsync(SpiSdCallback callback, void* context) 
+{
+  // don't disturb the operation in progress
+  if (asyncState_) {
+    error(SD_CARD_ERROR_ASYNC_BUSY);
+    return false;
+  }
 
-fail:
-  error(SD_CARD_ERROR_STOP_TRAN);
-  return false;
+  // non-zero until the stop token has been sent
+  asyncCount_ = 1;
+  return asyncStart(ASYNC_WRITE_STOP, callback, context);
 }
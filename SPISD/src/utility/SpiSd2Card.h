@@ -29,11 +29,29 @@ class SPIClass;
 #define SPI_HALF_SPEED    1
 #define SPI_QUARTER_SPEED 2
 
+/** SPI clock for card identification, must be at most 400 kHz */
+#define SD_INIT_CLOCK   250000
+
+/** SPI clock limit for cards that do not report a usable TRAN_SPEED */
+#define SD_DEFAULT_CLOCK 25000000
+
+/** init() chip select value if the SPI controller drives chip select */
+#define SD_CHIP_SELECT_AUTO 0XFF
+
 #define SD_INIT_TIMEOUT   2000
+// defaults until init() has read the card's own timeouts, see cardInfo()
 #define SD_ERASE_TIMEOUT 10000
 #define SD_READ_TIMEOUT    300
 #define SD_WRITE_TIMEOUT   600
 
+/** retries of a failed command or block transfer in CRC mode */
+#define SD_CRC_RETRIES       3
+
+/** set to one to count the bytes clocked on the SPI bus, see busBytes() */
+#ifndef SPISD_BUS_STATS
+#define SPISD_BUS_STATS      0
+#endif
+
 /** timeout error for command CMD0 */
 #define SD_CARD_ERROR_CMD0      0x01
 /** CMD8 was not accepted - not a valid SD card*/
@@ -78,75 +96,242 @@ class SPIClass;
 #define SD_CARD_ERROR_WRITE_TIMEOUT       0x15
 /** incorrect rate selected */
 #define SD_CARD_ERROR_SCK_RATE  0X16
+/** card returned an error response for CMD18 (read multiple block) */
+#define SD_CARD_ERROR_CMD18     0X17
+/** card returned an error response for CMD12 (stop transmission) */
+#define SD_CARD_ERROR_CMD12     0X18
+/** an asynchronous operation is already in progress */
+#define SD_CARD_ERROR_ASYNC_BUSY          0X19
+/** card returned an error response for CMD6 (switch function) */
+#define SD_CARD_ERROR_CMD6      0X1A
+/** card returned an error response for CMD59 (CRC on/off) */
+#define SD_CARD_ERROR_CMD59     0X1B
+/** read data or register did not match its CRC16 */
+#define SD_CARD_ERROR_READ_CRC  0X1C
+/** card rejected write data because of a CRC error */
+#define SD_CARD_ERROR_WRITE_CRC 0X1D
+
+// asynchronous operation status returned by asyncPoll()
+/** no operation in progress, the last one succeeded */
+#define SD_ASYNC_DONE     0
+/** operation in progress, call asyncPoll() again */
+#define SD_ASYNC_PENDING  1
+/** the last operation failed, see errorCode() */
+#define SD_ASYNC_ERROR    2
+
+// card status checks after writes, see statusCheck()
+/** send SEND_STATUS after every write */
+#define SD_STATUS_CHECK_ALWAYS 0
+/** send SEND_STATUS once in writeFinish(), called by sync */
+#define SD_STATUS_CHECK_SYNC   1
+/** rely on the data response token and busy timeout only */
+#define SD_STATUS_CHECK_NEVER  2
 
 // card types
 #define SD_CARD_TYPE_SD1  1
 #define SD_CARD_TYPE_SD2  2
 #define SD_CARD_TYPE_SDHC 3
 
+/**
+ *  Completion callback for asynchronous operations.
+ *  \a status is true for success, \a context is the pointer passed
+ *  when the operation was started.
+ */
+typedef void (*SpiSdCallback)(uint8_t status, void* context);
+
 class SpiSd2Card 
 {
 public:
   SpiSd2Card(SPIClass& spi)
-    : spi_(spi), errorCode_(0), inBlock_(0)
-     ,partialBlockRead_(0), type_(0) {}
+    : spi_(spi), chipSelectPin_(SD_CHIP_SELECT_AUTO), chipSelectAsserted_(0)
+     ,crc_(0), errorCode_(0), highSpeed_(0), inBlock_(0), partialBlockRead_(0)
+     ,type_(0), statusCheck_(SD_STATUS_CHECK_ALWAYS), statusPending_(0)
+     ,writeBehind_(0), writePending_(0), writeError_(0)
+     ,maxClock_(0), spiClock_(SD_INIT_CLOCK)
+     ,asyncState_(0), asyncStatus_(0) {
+    memset(&cid_, 0, sizeof(cid_));
+    memset(&csd_, 0, sizeof(csd_));
+#if SPISD_BUS_STATS
+    busBytes_ = 0;
+#endif  // SPISD_BUS_STATS
+  }
+
+  /** \return true if an asynchronous operation is in progress */
+  uint8_t asyncBusy(void) const { return asyncState_ != 0; }
+  uint8_t asyncPoll(void);
+  uint8_t asyncWait(void);
+
+#if SPISD_BUS_STATS
+  /** \return Bytes clocked on the SPI bus since the last busBytesClear() */
+  uint32_t busBytes(void) const { return busBytes_; }
+  void busBytesClear(void) { busBytes_ = 0; }
+#endif  // SPISD_BUS_STATS
+
+  /** \return Capabilities and timeouts read by init() */
+  const card_info_t* cardInfo(void) const { return &info_; }
   uint32_t cardSize(void);
   uint8_t erase(uint32_t firstBlock, uint32_t lastBlock);
+  uint8_t eraseAsync(uint32_t firstBlock, uint32_t lastBlock
+            ,SpiSdCallback callback = 0, void* context = 0);
   uint8_t eraseSingleBlockEnable(void);
 
   uint8_t errorCode(void) const { return errorCode_; }
   uint8_t errorData(void) const { return status_; }
 
+  /** \return true if init() switched the card to high speed mode */
+  uint8_t highSpeed(void) const { return highSpeed_; }
+
   uint8_t init(void) { return init(SPI_FULL_SPEED); }
-  uint8_t init(uint8_t sckRateID);
+  uint8_t init(uint8_t sckRateID
+            ,uint8_t chipSelectPin = SD_CHIP_SELECT_AUTO);
+  uint8_t initAsync(uint8_t sckRateID
+            ,uint8_t chipSelectPin = SD_CHIP_SELECT_AUTO
+            ,SpiSdCallback callback = 0, void* context = 0);
+
+  /** \return The card's rated SPI clock in Hz from the CSD TRAN_SPEED */
+  uint32_t maxClock(void) const { return maxClock_; }
 
   void partialBlockRead(uint8_t value);
   uint8_t partialBlockRead(void) const {return partialBlockRead_;}
   uint8_t readBlock(uint32_t block, uint8_t* dst);
+  uint8_t readBlocks(uint32_t block, uint32_t count, uint8_t* dst);
+  uint8_t readBlockAsync(uint32_t block, uint8_t* dst
+            ,SpiSdCallback callback = 0, void* context = 0) {
+    return readBlocksAsync(block, 1, dst, callback, context);
+  }
+  uint8_t readBlocksAsync(uint32_t block, uint32_t count, uint8_t* dst
+            ,SpiSdCallback callback = 0, void* context = 0);
   uint8_t readData(uint32_t block, uint16_t offset, uint16_t count, uint8_t* dst);
+  uint8_t readData(uint8_t* dst);
 
   /* Read a cards CID register. The CID contains card identification
    * information such as Manufacturer ID, Product name, Product serial
-   * number and Manufacturing date. */
-  uint8_t readCID(cid_t* cid) { return readRegister(CMD10, cid); }
+   * number and Manufacturing date.  The copy read by init() is returned. */
+  uint8_t readCID(cid_t* cid) { *cid = cid_; return type_ != 0; }
 
   /* Read a cards CSD register. The CSD contains Card-Specific Data that
-   * provides information regarding access to the card's contents. */
-  uint8_t readCSD(csd_t* csd) { return readRegister(CMD9, csd); }
+   * provides information regarding access to the card's contents.
+   * The copy read by init() is returned. */
+  uint8_t readCSD(csd_t* csd) { *csd = csd_; return type_ != 0; }
 
   void readEnd(void);
+  uint8_t readStart(uint32_t blockNumber);
+  uint8_t readStop(void);
+  uint8_t rampSpiClock(uint32_t limit);
   uint8_t setSckRate(uint8_t sckRateID);
   uint8_t setSpiClock(uint32_t clock);
 
+  /** \return The SPI clock in Hz used for data transfers */
+  uint32_t spiClock(void) const { return spiClock_; }
+
+  /** 
+   *  Select when card status is read after writes, one of
+   *  SD_STATUS_CHECK_ALWAYS, SD_STATUS_CHECK_SYNC or SD_STATUS_CHECK_NEVER.
+   */
+  void statusCheck(uint8_t policy) { statusCheck_ = policy; }
+  uint8_t statusCheck(void) const { return statusCheck_; }
+
   /** Return the card type: SD V1, SD V2 or SDHC */
   uint8_t type(void) const {return type_;}
+
+  uint8_t useCrc(uint8_t value);
+  /** \return true if commands and data are protected by CRC */
+  uint8_t useCrc(void) const { return crc_; }
+
   uint8_t writeBlock(uint32_t blockNumber, const uint8_t* src);
+  uint8_t writeBlocks(uint32_t blockNumber, uint32_t count, const uint8_t* src);
+  uint8_t writeBlockAsync(uint32_t blockNumber, const uint8_t* src
+            ,SpiSdCallback callback = 0, void* context = 0);
   uint8_t writeData(const uint8_t* src);
+  uint8_t writeDataAsync(const uint8_t* src
+            ,SpiSdCallback callback = 0, void* context = 0);
+  void writeBehind(uint8_t value) { writeBehind_ = value; }
+  /** \return true if writeBlock() returns before the card has programmed */
+  uint8_t writeBehind(void) const { return writeBehind_; }
+  uint8_t writeFinish(void);
   uint8_t writeStart(uint32_t blockNumber, uint32_t eraseCount);
   uint8_t writeStop(void);
+  uint8_t writeStopAsync(SpiSdCallback callback = 0, void* context = 0);
 
 private:
   SPIClass& spi_;
   uint32_t block_;
   uint8_t chipSelectPin_;
+  uint8_t chipSelectAsserted_;
+  uint8_t crc_;
   uint8_t errorCode_;
+  uint8_t highSpeed_;
   uint8_t inBlock_;
   uint16_t offset_;
   uint8_t partialBlockRead_;
   uint8_t status_;
   uint8_t type_;
+  uint8_t statusCheck_;
+  uint8_t statusPending_;
+  uint8_t writeBehind_;
+  uint8_t writePending_;
+  uint8_t writeError_;
+  uint32_t maxClock_;
+  uint32_t spiClock_;
+  card_info_t info_;
+  cid_t cid_;
+  csd_t csd_;
+#if SPISD_BUS_STATS
+  uint32_t busBytes_;
+#endif  // SPISD_BUS_STATS
+
+  // asynchronous operation states
+  static uint8_t const ASYNC_IDLE = 0;
+  static uint8_t const ASYNC_READ = 1;        // read data token and block
+  static uint8_t const ASYNC_READ_MULTI = 2;  // same for CMD18 sequence
+  static uint8_t const ASYNC_WRITE = 3;       // wait programming, CMD13
+  static uint8_t const ASYNC_WRITE_DATA = 4;  // wait programming in CMD25
+  static uint8_t const ASYNC_WRITE_STOP = 5;  // stop token, wait, CMD13
+  static uint8_t const ASYNC_ERASE = 6;       // wait erase
+  static uint8_t const ASYNC_INIT_CMD0 = 7;   // reset card, check version
+  static uint8_t const ASYNC_INIT_ACMD41 = 8; // wait ready, read registers
+
+  uint8_t asyncState_;
+  uint8_t asyncStatus_;
+  uint32_t asyncT0_;
+  uint32_t asyncTimeout_;
+  uint32_t asyncCount_;  // blocks to read, init rate or stop token flag
+  uint8_t* asyncDst_;
+  SpiSdCallback asyncCallback_;
+  void* asyncContext_;
 
+  uint8_t asyncFinish(uint8_t ok);
+  uint8_t asyncStart(uint8_t state, SpiSdCallback callback, void* context);
   uint8_t cardAcmd(uint8_t cmd, uint32_t arg);
   uint8_t cardCommand(uint8_t cmd, uint32_t arg);
+  void chipSelectHigh(void);
+  void chipSelectLow(void);
   uint8_t sendWriteCommand(uint32_t blockNumber, uint32_t eraseCount);
   void error(uint8_t code) {errorCode_ = code;}
+  uint32_t eraseTimeout(uint32_t firstBlock, uint32_t lastBlock) const;
+  uint8_t initStep(void);
+  uint8_t crcRetry(uint8_t retry) const {
+    return crc_ && retry < SD_CRC_RETRIES;
+  }
+  uint8_t readCheck(uint32_t* sum);
+  uint8_t readAppRegister(uint8_t acmd, uint8_t* dst, uint16_t count);
+  uint8_t readCrc(const uint8_t* data, uint16_t count);
+  void readInfo(void);
   uint8_t readRegister(uint8_t cmd, void* buf);
+  uint8_t readStatus(void);
+  uint8_t switchFunction(uint32_t arg, uint8_t* status);
+  uint8_t switchHighSpeed(void);
   void type(uint8_t value) {type_ = value;}
   uint8_t waitNotBusy(uint16_t timeoutMillis);
+  uint8_t writeCheck(void);
+  uint8_t writeStatus(void);
   uint8_t writeData(uint8_t token, const uint8_t* src);
   uint8_t waitStartBlock(void);
   void spiSend(uint8_t b);
   uint8_t spiRec(void);
+  void spiSend(const uint8_t* buf, size_t n);
+  void spiRec(uint8_t* buf, size_t n);
+  void spiSkip(size_t n);
 };
 
 
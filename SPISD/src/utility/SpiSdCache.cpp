@@ -0,0 +1,351 @@
+/**
+ * Arduino SdFat Library for SPRESENSE based on Arduino SdFat Library
+ *
+ * This file is part of the Arduino SdFat Library
+ *
+ * This Library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This Library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with the Arduino SdFat Library.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+#include "SpiSdFat.h"
+
+// longest run of blocks written by flush() with one command
+#define CACHE_MAX_RUN 32
+
+/**
+ *  Create a cache.
+ *
+ *  \param[in] entry Storage for the cached blocks.
+ *  \param[in] size Number of entries in \a entry, 1 to 254.
+ */
+SpiSdCache::SpiSdCache(SpiSdCacheEntry* entry, uint8_t size) 
+  :entry_(entry), size_(size) 
+{
+  init(0);
+}
+
+/**
+ *  Copy blocks to other places on the card, cached blocks are used as
+ *  they are and the others are read into the cache.  The copies are
+ *  written with multiple block writes.
+ *
+ *  \param[in] first The first block to copy.
+ *  \param[in] count The number of blocks to copy.
+ *  \param[in] offset Distance in blocks between copies.
+ *  \param[in] copies Number of copies, written at \a first + \a offset,
+ *  \a first + 2 * \a offset and so on.
+ *  \return The value one, true, is returned for success and
+ *  the value zero, false, is returned for failure.
+ */
+uint8_t SpiSdCache::copy(uint32_t first, uint32_t count
+          ,uint32_t offset, uint8_t copies) 
+{
+  uint8_t run[CACHE_MAX_RUN];
+
+  // the source goes to the card before its copies
+  if (!flush(first, count)) 
+    return false;
+
+  while (count) {
+    uint8_t n = count < size_ ? count : size_;
+    if (n > CACHE_MAX_RUN) n = CACHE_MAX_RUN;
+
+    // collect the chunk in n different entries
+    uint8_t spare = 0;
+    for (uint8_t k = 0; k < n; k++) {
+      uint8_t i = lookup(first + k);
+      if (i == END) {
+        // take an entry that isn't already part of the chunk
+        for (;; spare++) {
+          uint8_t used = false;
+          for (uint8_t j = 0; j < k; j++) {
+            if (run[j] == spare) used = true;
+          }
+          if (!used && (entry_[spare].block - first) >= n) 
+            break;
+        }
+        i = spare++;
+        if ((entry_[i].flags & DIRTY) && !writeEntry(i)) 
+          return false;
+
+        unlink(i);
+        entry_[i].flags = 0;
+        if (!dev_->readBlock(first + k, entry_[i].buf.data)) 
+          return false;
+
+        uint8_t h = (first + k) % size_;
+        entry_[i].block = first + k;
+        entry_[i].next = entry_[h].head;
+        entry_[h].head = i;
+      }
+      run[k] = i;
+    }
+
+    for (uint8_t c = 1; c <= copies; c++) {
+      if (!writeRun(run, n, first + c*offset)) 
+        return false;
+    }
+    first += n;
+    count -= n;
+  }
+  return true;
+}
+
+/**
+ *  \return The number of cached blocks that have not been written to
+ *  the card, zero if all of them are clean.
+ */
+uint8_t SpiSdCache::dirty(void) const 
+{
+  uint8_t n = 0;
+  for (uint8_t i = 0; i < size_; i++) {
+    if (entry_[i].flags & DIRTY) 
+      n++;
+  }
+  return n;
+}
+
+/**
+ *  Make a block the current block, reading it if it is not cached.
+ *
+ *  \param[in] block The block number.
+ *  \param[in] action FOR_READ, FOR_WRITE to mark the block dirty, or
+ *  FOR_WRITE | NO_READ for a block that will be overwritten.
+ *  \param[in] pin The pin class that holds the block or PIN_NONE.
+ *  \return Pointer to the block data or zero for an I/O error.
+ */
+cache_t* SpiSdCache::fetch(uint32_t block, uint8_t action, uint8_t pin) 
+{
+  uint8_t i = lookup(block);
+
+  if (i == END) {
+    i = victim();
+    if ((entry_[i].flags & DIRTY) && !writeEntry(i)) 
+      return 0;
+
+    unlink(i);
+    entry_[i].flags = 0;
+    if (!(action & NO_READ)) {
+      if (!dev_->readBlock(block, entry_[i].buf.data)) 
+        return 0;
+    }
+
+    // add to the hash chain for block
+    uint8_t h = block % size_;
+    entry_[i].block = block;
+    entry_[i].next = entry_[h].head;
+    entry_[h].head = i;
+  }
+
+  entry_[i].flags |= REF | (action & FOR_WRITE);
+  if (pin) pinned_[pin] = i;
+  cur_ = i;
+  return &entry_[i].buf;
+}
+
+/**
+ *  \param[in] block The block number.
+ *  \return Pointer to the cached data for \a block or zero if the block
+ *  is not cached.  The current block does not change.
+ */
+cache_t* SpiSdCache::find(uint32_t block) const 
+{
+  uint8_t i = lookup(block);
+  return i == END ? 0 : &entry_[i].buf;
+}
+
+/**
+ *  Write dirty blocks to the card in block order.
+ *
+ *  \param[in] first The first block of the range to write.
+ *  \param[in] count The number of blocks in the range.
+ *  \return The value one, true, is returned for success and
+ *  the value zero, false, is returned for failure.
+ */
+uint8_t SpiSdCache::flush(uint32_t first, uint32_t count) 
+{
+  uint8_t run[CACHE_MAX_RUN];
+
+  for (;;) {
+    // lowest dirty block in the range
+    uint8_t i = END;
+    for (uint8_t k = 0; k < size_; k++) {
+      if ((entry_[k].flags & DIRTY) 
+        && (entry_[k].block - first) < count
+        && (i == END || entry_[k].block < entry_[i].block)) {
+          i = k;
+      }
+    }
+    if (i == END) 
+      return true;
+
+    // collect the dirty blocks that follow it
+    uint8_t n = 1;
+    run[0] = i;
+    while (n < CACHE_MAX_RUN) {
+      uint32_t next = entry_[run[n - 1]].block + 1;
+      uint8_t j = lookup(next);
+      if (j == END || !(entry_[j].flags & DIRTY) || (next - first) >= count) 
+        break;
+      run[n++] = j;
+    }
+
+    if (!writeRun(run, n, entry_[run[0]].block)) 
+      return false;
+
+    // mirror FAT tables, split where the mirror blocks are not adjacent
+    for (uint8_t k = 0; k < n;) {
+      uint32_t mirror = entry_[run[k]].mirror;
+      uint8_t m = 1;
+      if (mirror) {
+        while ((k + m) < n && entry_[run[k + m]].mirror == (mirror + m)) 
+          m++;
+        if (!writeRun(run + k, m, mirror)) 
+          return false;
+      }
+      k += m;
+    }
+
+    for (uint8_t k = 0; k < n; k++) {
+      entry_[run[k]].flags &= ~DIRTY;
+      entry_[run[k]].mirror = 0;
+    }
+  }
+}
+
+/**
+ *  Forget all cached blocks without writing them.
+ *
+ *  \param[in] dev The card the blocks are read from and written to.
+ */
+void SpiSdCache::init(SpiSd2Card* dev) 
+{
+  dev_ = dev;
+  for (uint8_t i = 0; i < size_; i++) {
+    entry_[i].block = 0XFFFFFFFF;
+    entry_[i].mirror = 0;
+    entry_[i].flags = 0;
+    entry_[i].next = END;
+    entry_[i].head = END;
+  }
+  for (uint8_t i = 0; i < 4; i++) 
+    pinned_[i] = END;
+  cur_ = 0;
+  hand_ = 0;
+}
+
+/**
+ *  Forget cached copies of blocks that are about to be overwritten,
+ *  dirty copies are not written.
+ *
+ *  \param[in] first The first block of the range.
+ *  \param[in] count The number of blocks in the range.
+ */
+void SpiSdCache::invalidate(uint32_t first, uint32_t count) 
+{
+  for (uint8_t i = 0; i < size_; i++) {
+    if ((entry_[i].block - first) < count) {
+      unlink(i);
+      entry_[i].flags = 0;
+      entry_[i].mirror = 0;
+    }
+  }
+}
+
+// index of the entry holding block or END
+uint8_t SpiSdCache::lookup(uint32_t block) const 
+{
+  uint8_t i = entry_[block % size_].head;
+  while (i != END && entry_[i].block != block) 
+    i = entry_[i].next;
+  return i;
+}
+
+// remove entry i from its hash chain and mark it unused
+void SpiSdCache::unlink(uint8_t i) 
+{
+  uint32_t block = entry_[i].block;
+  if (block == 0XFFFFFFFF) 
+    return;
+
+  uint8_t* p = &entry_[block % size_].head;
+  while (*p != i) 
+    p = &entry_[*p].next;
+  *p = entry_[i].next;
+
+  entry_[i].block = 0XFFFFFFFF;
+  entry_[i].next = END;
+}
+
+// choose the entry to replace, pinned entries are skipped
+uint8_t SpiSdCache::victim(void) 
+{
+  // two sweeps clear every referenced bit
+  for (uint16_t n = 0; n < 2*size_; n++) {
+    uint8_t i = hand_;
+    hand_ = (hand_ + 1) % size_;
+
+    if (i == pinned_[PIN_FAT] || i == pinned_[PIN_DIR]
+      || i == pinned_[PIN_TAIL]) {
+      continue;
+    }
+
+    if (entry_[i].flags & REF) {
+      entry_[i].flags &= ~REF;
+      continue;
+    }
+    return i;
+  }
+
+  // every entry is pinned, too few entries to honor pins
+  uint8_t i = hand_;
+  hand_ = (hand_ + 1) % size_;
+  return i;
+}
+
+// write entry i and its mirror
+uint8_t SpiSdCache::writeEntry(uint8_t i) 
+{
+  if (!dev_->writeBlock(entry_[i].block, entry_[i].buf.data)) 
+    return false;
+
+  if (entry_[i].mirror) {
+    if (!dev_->writeBlock(entry_[i].mirror, entry_[i].buf.data)) 
+      return false;
+    entry_[i].mirror = 0;
+  }
+
+  entry_[i].flags &= ~DIRTY;
+  return true;
+}
+
+// write n entries to adjacent blocks starting at block
+uint8_t SpiSdCache::writeRun(uint8_t* run, uint8_t n, uint32_t block) 
+{
+  if (n > 1 && dev_->writeStart(block, n)) {
+    uint8_t k;
+    for (k = 0; k < n; k++) {
+      if (!dev_->writeData(entry_[run[k]].buf.data)) 
+        break;
+    }
+    if (dev_->writeStop() && k == n) 
+      return true;
+  }
+
+  // one block at a time, each write is retried in CRC mode
+  for (uint8_t k = 0; k < n; k++) {
+    if (!dev_->writeBlock(block + k, entry_[run[k]].buf.data)) 
+      return false;
+  }
+  return true;
+}
@@ -0,0 +1,76 @@
+/** 
+ * Arduino SdFat Library for SPRESENSE based on Arduino SdFat Library
+ *
+ * This file is part of the Arduino Sd2Card Library
+ *
+ * This Library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This Library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with the Arduino Sd2Card Library.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+#include "SpiSdCrc.h"
+
+// crc7Table[i] is the CRC7, shifted left one bit, of byte i
+static uint8_t crc7Table[256];
+
+// crc16Table[k][i] is the CRC16 of byte i followed by k zero bytes
+static uint16_t crc16Table[8][256];
+
+static uint8_t crcTablesReady = 0;
+
+static void crcTablesInit(void) 
+{
+  for (uint16_t i = 0; i < 256; i++) {
+    uint8_t c7 = i;
+    uint16_t c16 = i << 8;
+    for (uint8_t b = 0; b < 8; b++) {
+      c7 = c7 & 0X80 ? (c7 << 1) ^ 0X12 : c7 << 1;
+      c16 = c16 & 0X8000 ? (c16 << 1) ^ 0X1021 : c16 << 1;
+    }
+    crc7Table[i] = c7;
+    crc16Table[0][i] = c16;
+  }
+
+  // one more zero byte shifts the crc by eight bits
+  for (uint8_t k = 1; k < 8; k++) {
+    for (uint16_t i = 0; i < 256; i++) {
+      uint16_t c = crc16Table[k - 1][i];
+      crc16Table[k][i] = (c << 8) ^ crc16Table[0][c >> 8];
+    }
+  }
+  crcTablesReady = 1;
+}
+
+uint8_t SpiSdCrc7(const uint8_t* buf, size_t n) 
+{
+  if (!crcTablesReady) crcTablesInit();
+
+  uint8_t crc = 0;
+  while (n--) crc = crc7Table[crc ^ *buf++];
+  return crc | 1;
+}
+
+uint16_t SpiSdCrc16(const uint8_t* buf, size_t n) 
+{
+  if (!crcTablesReady) crcTablesInit();
+
+  uint16_t crc = 0;
+  for (; n >= 8; n -= 8, buf += 8) {
+    crc = crc16Table[7][buf[0] ^ (crc >> 8)]
+        ^ crc16Table[6][buf[1] ^ (crc & 0XFF)]
+        ^ crc16Table[5][buf[2]] ^ crc16Table[4][buf[3]]
+        ^ crc16Table[3][buf[4]] ^ crc16Table[2][buf[5]]
+        ^ crc16Table[1][buf[6]] ^ crc16Table[0][buf[7]];
+  }
+  while (n--) crc = (crc << 8) ^ crc16Table[0][(crc >> 8) ^ *buf++];
+  return crc;
+}
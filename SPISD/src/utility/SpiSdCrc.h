@@ -0,0 +1,46 @@
+/** 
+ * Arduino SdFat Library for SPRESENSE based on Arduino SdFat Library
+ *
+ * This file is part of the Arduino Sd2Card Library
+ *
+ * This Library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This Library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with the Arduino Sd2Card Library.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+#ifndef SpiSdCrc_h
+#define SpiSdCrc_h
+
+#include <stdint.h>
+#include <stddef.h>
+
+/**
+ *  CRC7 of an SD command.
+ *
+ *  \param[in] buf The command index byte and the four argument bytes.
+ *  \param[in] n Number of bytes, five for a command.
+ *  \return The CRC7 in bits 7:1 with the end bit set, ready to send.
+ */
+uint8_t SpiSdCrc7(const uint8_t* buf, size_t n);
+
+/**
+ *  CRC16 (CCITT, polynomial 0x1021, zero initial value) of an SD data
+ *  block.  Eight bytes are processed per step with slice-by-8 tables
+ *  that are built on the first call.
+ *
+ *  \param[in] buf Data block.
+ *  \param[in] n Number of bytes.
+ *  \return The CRC16 as sent after the data, high byte first.
+ */
+uint16_t SpiSdCrc16(const uint8_t* buf, size_t n);
+
+#endif  // SpiSdCrc_h
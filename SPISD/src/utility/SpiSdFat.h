@@ -86,7 +86,7 @@ class SpiSdVolume;
 /** SdFile for a FAT16 root directory */
 // uint8_t const FAT_FILE_TYPE_ROOT16 = 2;
 #define FAT_FILE_TYPE_ROOT16  2
-/** SdFile for a FAT32 root directory */
+/** SdFile for a FAT32 or exFAT root directory */
 // uint8_t const FAT_FILE_TYPE_ROOT32 = 3;
 #define FAT_FILE_TYPE_ROOT32  3
 /** SdFile for a subdirectory */
@@ -96,6 +96,46 @@ class SpiSdVolume;
 // uint8_t const FAT_FILE_TYPE_MIN_DIR = FAT_FILE_TYPE_ROOT16;
 #define FAT_FILE_TYPE_MIN_DIR 2
 
+// discard modes for clusters released by truncate() and remove()
+/** freed clusters keep their data */
+#define SD_DISCARD_OFF   0
+/** freed clusters are erased before truncate() or remove() returns */
+#define SD_DISCARD_NOW   1
+/** 
+ *  freed clusters are erased by discardPoll() while the card is idle,
+ *  a card command sent during an erase waits for it to finish
+ */
+#define SD_DISCARD_IDLE  2
+
+/** number of freed cluster ranges waiting to be erased, 1 to 255 */
+#ifndef SPISD_DISCARD_RANGES
+#define SPISD_DISCARD_RANGES 8
+#endif
+#if SPISD_DISCARD_RANGES < 1 || SPISD_DISCARD_RANGES > 255
+#error SPISD_DISCARD_RANGES must be 1 to 255
+#endif  // SPISD_DISCARD_RANGES
+
+/** 
+ *  most blocks one discardPoll() erases, at least one cluster, to bound
+ *  the wait of a command that follows it
+ */
+#ifndef SPISD_DISCARD_POLL_BLOCKS
+#define SPISD_DISCARD_POLL_BLOCKS 2048
+#endif
+
+/** number of cluster runs each file remembers, zero for none */
+#ifndef SPISD_FILE_EXTENTS
+#define SPISD_FILE_EXTENTS 4
+#endif
+
+/** 
+ *  characters changed by the exFAT up-case table that are kept in RAM,
+ *  at most 255, enough for ASCII and Latin-1
+ */
+#ifndef SPISD_UPCASE_PAIRS
+#define SPISD_UPCASE_PAIRS 64
+#endif
+
 /** date field for FAT directory entry */
 static inline uint16_t FAT_DATE(uint16_t year, uint8_t month, uint8_t day) {
   return (year - 1980) << 9 | month << 5 | day;
@@ -137,7 +177,7 @@ uint16_t const FAT_DEFAULT_TIME = (1 << 11);
 
 /**
  *  \class SdFile
- *  \brief Access FAT16 and FAT32 files on SD and SDHC cards.
+ *  \brief Access FAT16, FAT32 and exFAT files on SD, SDHC and SDXC cards.
  */
 class SpiSdFile : public Print {
 public:
@@ -148,10 +188,10 @@ public:
   uint8_t close(void);
   uint8_t contiguousRange(uint32_t* bgnBlock, uint32_t* endBlock);
   uint8_t createContiguous(SpiSdFile* dirFile
-             ,const char* fileName, uint32_t size);
+             ,const char* fileName, uint64_t size);
 
   uint32_t curCluster(void) const  { return curCluster_; }
-  uint32_t curPosition(void) const { return curPosition_; }
+  uint64_t curPosition(void) const { return curPosition_; }
 
   /**
    *  Set the date/time callback function
@@ -185,8 +225,9 @@ public:
   uint8_t dirIndex(void) const { return dirIndex_; }
   static void dirName(const dir_t& dir, char* name);
 
-  uint32_t fileSize(void) const {return fileSize_;}
+  uint64_t fileSize(void) const {return fileSize_;}
   uint32_t firstCluster(void) const {return firstCluster_;}
+  uint8_t getName(char* name, uint16_t size);
 
   uint8_t isDir(void) const  { return type_ >= FAT_FILE_TYPE_MIN_DIR; }
   uint8_t isFile(void) const { return type_ == FAT_FILE_TYPE_NORMAL; }
@@ -199,6 +240,7 @@ public:
   uint8_t makeDir(SpiSdFile* dir, const char* dirName);
   uint8_t open(SpiSdFile* dirFile, uint16_t index, uint8_t oflag);
   uint8_t open(SpiSdFile* dirFile, const char* fileName, uint8_t oflag);
+  uint8_t openNext(SpiSdFile* dirFile, uint8_t oflag = O_READ);
 
   uint8_t openRoot(SpiSdVolume* vol);
 
@@ -222,9 +264,9 @@ public:
   uint8_t rmDir(void);
   uint8_t rmRfStar(void);
 
-  uint8_t seekCur(uint32_t pos) { return seekSet(curPosition_ + pos); }
+  uint8_t seekCur(int32_t pos) { return seekSet(curPosition_ + pos); }
   uint8_t seekEnd(void) { return seekSet(fileSize_); }
-  uint8_t seekSet(uint32_t pos);
+  uint8_t seekSet(uint64_t pos);
 
   /**
    *  Use unbuffered reads to access this file.  Used with Wave
@@ -247,7 +289,7 @@ public:
    *  \return The file or directory type.
    */
   uint8_t type(void) const { return type_; }
-  uint8_t truncate(uint32_t size);
+  uint8_t truncate(uint64_t size);
 
   /** \return Unbuffered read flag. */
   uint8_t unbufferedRead(void) const {
@@ -267,7 +309,7 @@ public:
   }
 
   uint8_t createContiguous(SpiSdFile& dirFile
-            ,const char* fileName, uint32_t size) 
+            ,const char* fileName, uint64_t size) 
   {
     return createContiguous(&dirFile, fileName, size);
   }
@@ -319,34 +361,61 @@ private:
   // should be 0XF
   static uint8_t const F_OFLAG = (O_ACCMODE | O_APPEND | O_SYNC);
   // available bits
-  static uint8_t const F_UNUSED = 0X30;
+  static uint8_t const F_UNUSED = 0X10;
+  // exFAT file with contiguous clusters and no FAT chain
+  static uint8_t const F_FILE_NO_CHAIN = 0X20;
   // use unbuffered SD read
   static uint8_t const F_FILE_UNBUFFERED_READ = 0X40;
   // sync of directory entry required
   static uint8_t const F_FILE_DIR_DIRTY = 0X80;
 
 // make sure F_OFLAG is ok
-#if ((F_UNUSED | F_FILE_UNBUFFERED_READ | F_FILE_DIR_DIRTY) & F_OFLAG)
+#if ((F_UNUSED | F_FILE_NO_CHAIN | F_FILE_UNBUFFERED_READ | F_FILE_DIR_DIRTY) \
+  & F_OFLAG)
 #error flags_ bits conflict
 #endif  // flags_ bits
 
   uint8_t   flags_;          // See above for definition of flags_ bits
   uint8_t   type_;           // type of file see above for values
   uint32_t  curCluster_;     // cluster for current file position
-  uint32_t  curPosition_;    // current file position in bytes from beginning
+  uint64_t  curPosition_;    // current file position in bytes from beginning
   uint32_t  dirBlock_;       // SD block that contains directory entry for file
   uint8_t   dirIndex_;       // index of entry in dirBlock 0 <= dirIndex_ <= 0XF
-  uint32_t  fileSize_;       // file size in bytes
+  uint64_t  fileSize_;       // file size in bytes, over 4 GB only on exFAT
+  uint64_t  validLength_;    // bytes written, the rest of an exFAT file is zero
   uint32_t  firstCluster_;   // first cluster of file
+  uint32_t  setBlock_;       // exFAT entry set block after dirBlock_
+  uint32_t  contigClusters_; // clusters of a file with F_FILE_NO_CHAIN
   SpiSdVolume* vol_;         // volume where file is located
+#if SPISD_FILE_EXTENTS
+  // known start of the cluster chain as runs of adjacent clusters
+  uint8_t   extentCount_;                      // runs in use
+  uint32_t  extentStart_[SPISD_FILE_EXTENTS];  // first cluster of a run
+  uint32_t  extentEnd_[SPISD_FILE_EXTENTS];    // cluster index after a run
+#endif
 
   uint8_t addCluster(void);
   uint8_t addDirCluster(void);
   dir_t* cacheDirEntry(uint8_t action);
   static void (*dateTime_)(uint16_t* date, uint16_t* time);
+  void extentAdd(uint32_t index, uint32_t cluster, uint32_t count = 1);
+  void extentCut(uint32_t count);
+  uint32_t extentFind(uint32_t index) const;
+  uint32_t extentKnown(void) const;
+  dir_t* exFatEntry(uint8_t k, uint8_t action);
+  uint8_t exFatOpen(SpiSdFile* dirFile, const char* fileName, uint8_t oflag);
+  uint8_t exFatOpenSet(SpiSdFile* dirFile, uint8_t oflag);
+  uint8_t exFatSync(uint8_t stamp);
+  uint8_t freeTail(uint32_t tail, uint32_t index);
+  uint8_t growChain(uint32_t* cluster);
   static uint8_t make83Name(const char* str, uint8_t* name);
+  uint8_t nextCluster(uint32_t index, uint32_t* cluster);
   uint8_t openCachedEntry(uint8_t cacheIndex, uint8_t oflags);
   dir_t* readDirCache(void);
+  uint32_t runBlocks(uint32_t maxCount, uint32_t* tail);
+  uint8_t syncDirEntry(uint8_t stamp);
+  uint8_t walkChain(uint32_t index, uint32_t* cluster, uint32_t count);
+  uint8_t zeroFill(void);
 };
 
 /**
@@ -365,16 +434,122 @@ union cache_t {
   mbr_t    mbr;
   /** Used to access to a cached FAT boot sector. */
   fbs_t    fbs;
+  /** Used to access to a cached exFAT boot sector. */
+  exfbs_t  exfbs;
+  /** Used to access a cached FAT32 FSInfo sector. */
+  fsinfo_t fsinfo;
+};
+
+/** number of 512 byte blocks in the directory and data cache */
+#ifndef SPISD_CACHE_BLOCKS
+#define SPISD_CACHE_BLOCKS 8
+#endif
+
+/** number of 512 byte blocks in the FAT cache */
+#ifndef SPISD_FAT_CACHE_BLOCKS
+#define SPISD_FAT_CACHE_BLOCKS 4
+#endif
+
+/**
+ *  \brief A cached block and its bookkeeping
+ */
+struct SpiSdCacheEntry {
+  /** block data */
+  cache_t  buf;
+  /** block number, 0XFFFFFFFF if the entry is unused */
+  uint32_t block;
+  /** FAT mirror block written along with this block, zero if none */
+  uint32_t mirror;
+  /** dirty and referenced bits */
+  uint8_t  flags;
+  /** next entry in the same hash chain, 0XFF ends the chain */
+  uint8_t  next;
+  /** first entry of the hash chain for this entry's index */
+  uint8_t  head;
+};
+
+/**
+ *  \class SpiSdCache
+ *  \brief A set of cached SD blocks.
+ *
+ *  Blocks are found through a hash table and replaced with the CLOCK
+ *  algorithm.  Dirty blocks are written when they are replaced or by
+ *  flush(), which writes runs of adjacent blocks with one multiple block
+ *  write.  The last block returned by fetch() is the current block.
+ */
+class SpiSdCache {
+public:
+  /** pin classes, one entry per class is never replaced */
+  static uint8_t const PIN_NONE = 0;
+  static uint8_t const PIN_FAT  = 1;
+  static uint8_t const PIN_DIR  = 2;
+  static uint8_t const PIN_TAIL = 3;
+
+  /** fetch() action bits */
+  static uint8_t const FOR_READ  = 0;
+  static uint8_t const FOR_WRITE = 1;
+  static uint8_t const NO_READ   = 2;
+
+  SpiSdCache(SpiSdCacheEntry* entry, uint8_t size);
+
+  /** \return The current block's data. */
+  cache_t* buffer(void) const { return &entry_[cur_].buf; }
+
+  /** \return The current block's number, 0XFFFFFFFF if none. */
+  uint32_t blockNumber(void) const { return entry_[cur_].block; }
+
+  uint8_t copy(uint32_t first, uint32_t count
+            ,uint32_t offset, uint8_t copies);
+  uint8_t dirty(void) const;
+  cache_t* fetch(uint32_t block, uint8_t action, uint8_t pin = PIN_NONE);
+  cache_t* find(uint32_t block) const;
+  uint8_t flush(uint32_t first = 0, uint32_t count = 0XFFFFFFFF);
+  void init(SpiSd2Card* dev);
+  void invalidate(uint32_t first, uint32_t count);
+
+  /** Mark the current block dirty. */
+  void setDirty(void) { entry_[cur_].flags |= DIRTY; }
+
+  /** Write the current block to \a block as well when it is flushed. */
+  void setMirror(uint32_t block) { entry_[cur_].mirror = block; }
+
+  /** \return The number of cached blocks. */
+  uint8_t size(void) const { return size_; }
+
+private:
+  static uint8_t const DIRTY = 1;
+  static uint8_t const REF   = 2;
+  static uint8_t const END   = 0XFF;
+
+  SpiSd2Card* dev_;
+  SpiSdCacheEntry* entry_;
+  uint8_t size_;
+  uint8_t cur_;       // entry returned by the last fetch()
+  uint8_t hand_;      // CLOCK hand
+  uint8_t pinned_[4]; // entry held by each pin class
+
+  uint8_t lookup(uint32_t block) const;
+  void unlink(uint8_t i);
+  uint8_t victim(void);
+  uint8_t writeEntry(uint8_t i);
+  uint8_t writeRun(uint8_t* run, uint8_t n, uint32_t block);
 };
 
 /**
  *  \class SdVolume
- *  \brief Access FAT16 and FAT32 volumes on SD and SDHC cards.
+ *  \brief Access FAT16, FAT32 and exFAT volumes on SD, SDHC and SDXC cards.
  */
 class SpiSdVolume {
 public:
   /** Create an instance of SdVolume */
-  SpiSdVolume(void) :allocSearchStart_(2), fatType_(0) {}
+  SpiSdVolume(void) :allocSearchStart_(2), fatType_(0)
+     ,discardMode_(SD_DISCARD_OFF), discardCount_(0)
+     ,useBitmap_(0), bitmap_(0), fsInfoBlock_(0)
+     ,freeCount_(0XFFFFFFFF), fsInfoDirty_(0), allocBitmapStart_(0)
+     ,upcaseStart_(0), upcaseSize_(0), upcaseIndex_(0), upcaseLimit_(0)
+     ,upcaseCount_(0) {}
+
+  ~SpiSdVolume(void) { free(bitmap_); }
 
   /** 
    *  Clear the cache and returns a pointer to the cache.  
@@ -383,10 +558,78 @@ public:
    */
   static uint8_t* cacheClear(void) {
     cacheFlush();
-    cacheBlockNumber_ = 0XFFFFFFFF;
-    return cacheBuffer_.data;
+    cache_.invalidate(0, 0XFFFFFFFF);
+    return cache_.buffer()->data;
+  }
+
+  /** 
+   *  Select when dirty FAT blocks are written.  With write-back, the
+   *  default, they stay cached until sync() or until the FAT cache is
+   *  full.  Without it a dirty FAT block is written as soon as another
+   *  FAT block is needed.
+   *
+   *  \param[in] enable Keep several dirty FAT blocks if true.
+   */
+  static void fatWriteBack(uint8_t enable) { fatWriteBack_ = enable; }
+
+  /** \return The FAT write-back setting, see fatWriteBack(uint8_t). */
+  static uint8_t fatWriteBack(void) { return fatWriteBack_; }
+
+  /** 
+   *  Write the second FAT only at sync points.  The changed part of
+   *  the first FAT is copied by flush(), SpiSdFile::sync() and
+   *  SpiSdFile::close(), so the copies match after each of them.
+   *
+   *  \param[in] enable Defer the mirror writes if true.
+   */
+  static void fatMirrorDefer(uint8_t enable) { mirrorDefer_ = enable; }
+
+  /** \return The value one, true, if mirror writes are deferred. */
+  static uint8_t fatMirrorDefer(void) { return mirrorDefer_; }
+
+  uint8_t fatInRam(uint32_t maxBytes);
+
+  /** \return The value one, true, if the FAT is held in RAM. */
+  static uint8_t fatInRam(void) { return fatRam_ != 0; }
+
+  /** 
+   *  Write all cached blocks, FAT copies, the FSInfo sector and a
+   *  write-behind block.
+   *
+   *  \return The value one, true, is returned for success and
+   *  the value zero, false, is returned for failure.
+   */
+  uint8_t flush(void) {
+    return fsInfoSync() && cacheFlush() && sdCard_->writeFinish();
+  }
+
+  uint8_t tick(void);
+
+  /** 
+   *  Select when cached writes reach the card without a sync().  Dirty
+   *  blocks are written in one batch once \a maxDirty of them are
+   *  cached or \a maxMs milliseconds after the first one was changed,
+   *  whichever comes first.  The limits are checked by SpiSdFile::write()
+   *  and tick().  The directory entry of a file being written is kept
+   *  current to its last block, the modify time is set by sync().  Zero
+   *  for both, the default, writes only at sync points and when the
+   *  cache is full.
+   *
+   *  \param[in] maxDirty Dirty block limit, zero for none.
+   *  \param[in] maxMs Age limit in milliseconds, zero for none.
+   */
+  static void writeBack(uint8_t maxDirty, uint32_t maxMs) {
+    flushDirty_ = maxDirty;
+    flushMs_ = maxMs;
+    dirtySince_ = 0;
   }
 
+  /** \return The dirty block limit, see writeBack(uint8_t, uint32_t). */
+  static uint8_t writeBackDirty(void) { return flushDirty_; }
+
+  /** \return The age limit, see writeBack(uint8_t, uint32_t). */
+  static uint32_t writeBackMs(void) { return flushMs_; }
+
   /**
    *  Initialize a FAT volume.  Try partition one first then try super
    *  floppy format.
@@ -405,7 +648,7 @@ public:
   uint8_t init(SpiSd2Card* dev, uint8_t part);
 
   /** \return The volume's cluster size in blocks. */
-  uint8_t blocksPerCluster(void) const { return blocksPerCluster_; }
+  uint32_t blocksPerCluster(void) const { return blocksPerCluster_; }
 
   /** \return The number of blocks in one FAT. */
   uint32_t blocksPerFat(void)  const { return blocksPerFat_; }
@@ -419,13 +662,47 @@ public:
   /** \return The logical block number for the start of file data. */
   uint32_t dataStartBlock(void) const { return dataStartBlock_; }
 
+  /** 
+   *  Select what happens to clusters freed by truncate() and remove().
+   *
+   *  \param[in] mode SD_DISCARD_OFF, SD_DISCARD_NOW or SD_DISCARD_IDLE.
+   */
+  void discard(uint8_t mode) { discardMode_ = mode; }
+
+  /** \return The discard mode, see discard(uint8_t). */
+  uint8_t discard(void) const { return discardMode_; }
+
+  uint8_t discardFlush(void);
+  uint8_t discardPoll(void);
+
+  /** \return The number of freed cluster ranges waiting to be erased. */
+  uint8_t discardPending(void) const { return discardCount_; }
+
+  uint8_t freeBitmap(uint8_t enable);
+
+  /** \return The value one, true, if the free cluster bitmap is in use. */
+  uint8_t freeBitmap(void) const { return bitmap_ != 0; }
+
+  uint32_t freeClusterCount(uint8_t recount = false);
+
+  /** 
+   *  \return The number of free clusters or 0XFFFFFFFF if it is not
+   *  known.  The count is read from the FSInfo sector of a FAT32
+   *  volume, or counted by the free cluster bitmap, and kept current
+   *  by allocation and freeing.
+   */
+  uint32_t freeClusters(void) const { return freeCount_; }
+
   /** \return The number of FAT structures on the volume. */
   uint8_t fatCount(void) const { return fatCount_; }
 
   /** \return The logical block number for the start of the first FAT. */
   uint32_t fatStartBlock(void) const { return fatStartBlock_; }
 
-  /** \return The FAT type of the volume. Values are 12, 16 or 32. */
+  /** 
+   *  \return The FAT type of the volume. Values are 12, 16, 32 or 64
+   *  for exFAT.
+   */
   uint8_t fatType(void) const { return fatType_;  }
 
   /** 
@@ -436,7 +713,8 @@ public:
 
   /** 
    *  \return The logical block number for the start of the root directory
-   *  on FAT16 volumes or the first cluster number on FAT32 volumes. 
+   *  on FAT16 volumes or the first cluster number on FAT32 and exFAT
+   *  volumes. 
    */
   uint32_t rootDirStart(void) const { return rootDirStart_; }
 
@@ -454,29 +732,78 @@ public:
 private:
   friend class SpiSdFile;
 
-  static uint8_t const CACHE_FOR_READ = 0;
-  static uint8_t const CACHE_FOR_WRITE = 1;
-
-  static cache_t cacheBuffer_;        // 512 byte cache for device blocks
-  static uint32_t cacheBlockNumber_;  // Logical number of block in the cache
+  static uint8_t const CACHE_FOR_READ = SpiSdCache::FOR_READ;
+  static uint8_t const CACHE_FOR_WRITE = SpiSdCache::FOR_WRITE;
+  // dirty block that will be overwritten, don't read it
+  static uint8_t const CACHE_RESERVE_FOR_WRITE = 
+    SpiSdCache::FOR_WRITE | SpiSdCache::NO_READ;
+
+  static SpiSdCacheEntry cacheEntry_[SPISD_CACHE_BLOCKS];  // cached blocks
+  static SpiSdCache cache_;           // directory and data block cache
+  static SpiSdCacheEntry fatCacheEntry_[SPISD_FAT_CACHE_BLOCKS];
+  static SpiSdCache fatCache_;        // FAT block cache
+  static uint8_t fatWriteBack_;       // keep several dirty FAT blocks
+  static uint8_t mirrorDefer_;        // copy the FAT at sync points
+  static uint32_t mirrorFirst_;       // first FAT block not yet copied
+  static uint32_t mirrorLast_;        // last FAT block not yet copied
+  static uint32_t mirrorOffset_;      // blocks between FAT copies
+  static uint8_t mirrorCopies_;       // number of FAT copies to write
+  static cache_t* fatRam_;            // the first FAT in RAM or zero
+  static uint8_t* fatRamDirty_;       // one bit per changed FAT block
+  static uint32_t fatRamBlocks_;      // FAT blocks in fatRam_
+  static uint32_t fatRamStart_;       // first block of the first FAT
+  static uint8_t fatRamChanged_;      // some FAT block is dirty
+  static uint32_t fatRamMax_;         // largest FAT to load, zero for none
+  static uint8_t flushDirty_;         // flush at this many dirty blocks
+  static uint32_t flushMs_;           // flush this long after a change
+  static uint32_t dirtySince_;        // millis() of the first change or zero
   static SpiSd2Card* sdCard_;         // Sd2Card object for cache
-  static uint8_t cacheDirty_;         // cacheFlush() will write block if true
-  static uint32_t cacheMirrorBlock_;  // block number for mirror FAT
 
   uint32_t allocSearchStart_;   // start cluster for alloc search
-  uint8_t blocksPerCluster_;    // cluster size in blocks
+  uint32_t blocksPerCluster_;   // cluster size in blocks
   uint32_t blocksPerFat_;       // FAT size in blocks
   uint32_t clusterCount_;       // clusters in one FAT
   uint8_t clusterSizeShift_;    // shift to convert cluster count to block count
   uint32_t dataStartBlock_;     // first data block number
   uint8_t fatCount_;            // number of FATs on volume
   uint32_t fatStartBlock_;      // start block for first FAT
-  uint8_t fatType_;             // volume type (12, 16, OR 32)
+  uint8_t fatType_;             // volume type (12, 16, 32 OR 64 for exFAT)
   uint16_t rootDirEntryCount_;  // number of entries in FAT16 root dir
   uint32_t rootDirStart_;       // root start block for FAT16, cluster for FAT32
-
-  uint8_t allocContiguous(uint32_t count, uint32_t* curCluster);
-  uint8_t blockOfCluster(uint32_t position) const {
+  uint8_t discardMode_;         // what to do with freed clusters
+  uint8_t discardCount_;        // number of ranges in discardFirst_/Last_
+  uint32_t discardFirst_[SPISD_DISCARD_RANGES];  // freed cluster ranges
+  uint32_t discardLast_[SPISD_DISCARD_RANGES];   //  not yet erased
+  uint8_t useBitmap_;           // build the free cluster bitmap in init()
+  uint32_t* bitmap_;            // one bit per cluster, set if in use
+  uint32_t fsInfoBlock_;        // FAT32 FSInfo block, zero if none
+  uint32_t freeCount_;          // free clusters, 0XFFFFFFFF if unknown
+  uint8_t fsInfoDirty_;         // free count or search start changed
+  uint32_t allocBitmapStart_;   // first block of the exFAT allocation bitmap
+  uint32_t upcaseStart_;        // first block of the exFAT up-case table
+  uint32_t upcaseSize_;         // entries in the up-case table
+  uint32_t upcaseIndex_;        // table entry for upcaseLimit_
+  uint32_t upcaseLimit_;        // first character not in upcaseChar_
+  uint8_t upcaseCount_;         // pairs in upcaseChar_/upcaseUpper_
+  uint16_t upcaseChar_[SPISD_UPCASE_PAIRS];   // characters the table
+  uint16_t upcaseUpper_[SPISD_UPCASE_PAIRS];  //  changes, in order
+
+  uint32_t allocBitmapCount(void);
+  uint32_t allocBitmapFind(uint32_t from, uint32_t count);
+  uint8_t allocBitmapSet(uint32_t cluster, uint32_t count, uint8_t used);
+  uint8_t allocContiguous(uint32_t count, uint32_t* curCluster
+            ,uint8_t chain = true);
+  static void bitmapBlock(SpiSdVolume* vol, uint32_t cluster
+                ,const cache_t* pc, uint16_t n);
+  uint8_t bitmapBuild(void);
+  uint32_t bitmapFind(uint32_t from, uint32_t to, uint32_t count) const;
+  void bitmapSet(uint32_t cluster, uint8_t used) {
+    if (used) 
+      bitmap_[cluster >> 5] |= 1UL << (cluster & 31);
+    else
+      bitmap_[cluster >> 5] &= ~(1UL << (cluster & 31));
+  }
+  uint32_t blockOfCluster(uint32_t position) const {
     return (position >> 9) & (blocksPerCluster_ - 1);
   }
 
@@ -488,18 +815,77 @@ private:
     return clusterStartBlock(cluster) + blockOfCluster(position);
   }
 
-  static uint8_t cacheFlush(void);
-  static uint8_t cacheRawBlock(uint32_t blockNumber, uint8_t action);
-  static void cacheSetDirty(void) { cacheDirty_ |= CACHE_FOR_WRITE; }
+  // data and number of the block returned by the last cacheRawBlock()
+  static cache_t* cacheBuffer(void) { return cache_.buffer(); }
+  static uint32_t cacheBlockNumber(void) { return cache_.blockNumber(); }
+
+  // FAT first, a crash then loses clusters instead of linking free ones
+  static uint8_t cacheFlush(void) {
+    if (!fatCache_.flush() || !mirrorFlush() || !fatRamFlush() 
+      || !cache_.flush()) 
+      return false;
+    dirtySince_ = 0;
+    return true;
+  }
+
+  // write dirty cached blocks in a range
+  static uint8_t cacheFlush(uint32_t blockNumber, uint32_t count) {
+    return cache_.flush(blockNumber, count);
+  }
+
+  // forget a cached copy of blocks that are about to be overwritten
+  static void cacheInvalidate(uint32_t blockNumber, uint32_t count) {
+    cache_.invalidate(blockNumber, count);
+  }
+
+  static uint8_t cacheIsCached(uint32_t blockNumber) {
+    return cache_.find(blockNumber) != 0;
+  }
+
+  static uint8_t cacheRawBlock(uint32_t blockNumber, uint8_t action
+                   ,uint8_t pin = SpiSdCache::PIN_NONE) {
+    return cache_.fetch(blockNumber, action, pin) != 0;
+  }
+
+  static void cacheSetDirty(void) { cache_.setDirty(); }
   static uint8_t cacheZeroBlock(uint32_t blockNumber);
   uint8_t chainSize(uint32_t beginCluster, uint32_t* size) const;
+  static void countBlock(SpiSdVolume* vol, uint32_t cluster
+                ,const cache_t* pc, uint16_t n);
+  // FAT block that holds the entry for cluster
+  uint32_t fatBlock(uint32_t cluster) const {
+    return fatStartBlock_ + (fatType_ == 16 ? cluster >> 8 : cluster >> 7);
+  }
+
+  // entry for cluster in the FAT block that holds it
+  uint32_t fatEntry(const cache_t* pc, uint32_t cluster) const {
+    return fatType_ == 16 ? pc->fat16[cluster & 0XFF]
+                          : pc->fat32[cluster & 0X7F] & FAT32MASK;
+  }
+
   uint8_t fatGet(uint32_t cluster, uint32_t* value) const;
+  uint8_t fatLinkRun(uint32_t first, uint32_t last);
+  uint32_t fatRunLength(uint32_t cluster) const;
   uint8_t fatPut(uint32_t cluster, uint32_t value);
+  static uint8_t fatRamFlush(void);
+  static void fatRamFree(void);
+  uint8_t fatRamLoad(void);
+  void fatStore(cache_t* pc, uint32_t cluster, uint32_t value);
+  cache_t* fatWriteBlock(uint32_t lba, uint8_t action = CACHE_FOR_WRITE);
+  uint8_t fatScan(void (*fn)(SpiSdVolume* vol, uint32_t cluster
+                    ,const cache_t* pc, uint16_t n));
   uint8_t fatPutEOC(uint32_t cluster) {
     return fatPut(cluster, 0x0FFFFFFF);
   }
 
+  void discardAdd(uint32_t cluster);
+  void discardCancel(uint32_t first, uint32_t last);
+  uint8_t discardRange(uint8_t i, uint8_t wait);
+  uint8_t exFatInit(uint32_t volumeStartBlock);
   uint8_t freeChain(uint32_t cluster);
+  uint8_t freeRun(uint32_t cluster, uint32_t count);
+  uint8_t fsInfoSync(void);
+  static uint8_t mirrorFlush(void);
   uint8_t isEOC(uint32_t cluster) const {
     return  cluster >= (fatType_ == 16 ? FAT16EOC_MIN : FAT32EOC_MIN);
   }
@@ -508,14 +894,26 @@ private:
     return sdCard_->readBlock(block, dst);
   }
 
+  uint8_t readBlocks(uint32_t block, uint32_t count, uint8_t* dst) {
+    return sdCard_->readBlocks(block, count, dst);
+  }
+
   uint8_t readData(uint32_t block, uint16_t offset
     ,uint16_t count, uint8_t* dst) {
       return sdCard_->readData(block, offset, count, dst);
   }
 
+  uint16_t upcase(uint16_t c);
+  uint8_t upcaseLoad(void);
+  uint8_t writeBackDue(void);
+
   uint8_t writeBlock(uint32_t block, const uint8_t* dst) {
     return sdCard_->writeBlock(block, dst);
   }
+
+  uint8_t writeBlocks(uint32_t block, uint32_t count, const uint8_t* src) {
+    return sdCard_->writeBlocks(block, count, src);
+  }
 };
 
 #ifdef REDEFINE_REWIND_FOR_STDIO_H
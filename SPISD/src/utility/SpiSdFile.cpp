@@ -20,6 +20,12 @@
 #include "SpiSdFat.h"
 #include <Arduino.h>
 
+// FAT blocks a streamed chain walk reads past to reach the next link
+#define WALK_MAX_GAP 4
+
+// longest exFAT name created or opened, its entry set of 17 entries
+// spans two directory blocks at most
+#define EXFAT_NAME_MAX 225
 
 // callback function for date/time
 void (*SpiSdFile::dateTime_)(uint16_t* date, uint16_t* time) = NULL;
@@ -27,10 +33,23 @@ void (*SpiSdFile::dateTime_)(uint16_t* date, uint16_t* time) = NULL;
 // suppress cpplint warnings with NOLINT comment
 void (*SpiSdFile::oldDateTime_)(uint16_t& date, uint16_t& time) = NULL; 
 
+// add the 32 bytes of an entry to an exFAT entry set checksum, the
+// checksum field of the first entry is skipped
+static uint16_t exFatChecksum(uint16_t sum, const void* entry, uint8_t first) 
+{
+  const uint8_t* p = reinterpret_cast<const uint8_t*>(entry);
+  for (uint8_t i = 0; i < 32; i++) {
+    if (first && (i == 2 || i == 3)) 
+      continue;
+    sum = ((sum & 1) ? 0X8000 : 0) + (sum >> 1) + p[i];
+  }
+  return sum;
+}
+
 // add a cluster to a file
 uint8_t SpiSdFile::addCluster() 
 {
-  if (!vol_->allocContiguous(1, &curCluster_)) 
+  if (!growChain(&curCluster_)) 
     return false;
 
   // if first cluster of file link to directory entry
@@ -49,15 +68,22 @@ uint8_t SpiSdFile::addDirCluster(void)
   if (!addCluster()) 
     return false;
 
+  extentAdd(fileSize_ >> (vol_->clusterSizeShift_ + 9), curCluster_);
+
   // zero data in cluster insure first cluster is in cache
   uint32_t block = vol_->clusterStartBlock(curCluster_);
-  for (uint8_t i = vol_->blocksPerCluster_; i != 0; i--) {
+  for (uint32_t i = vol_->blocksPerCluster_; i != 0; i--) {
     if (!SpiSdVolume::cacheZeroBlock(block + i - 1)) 
       return false;
   }
 
   // Increase directory file size by cluster size
   fileSize_ += 512UL << vol_->clusterSizeShift_;
+  validLength_ = fileSize_;
+
+  // an exFAT directory keeps its size in its entry set
+  if (vol_->fatType_ == 64 && !isRoot()) 
+    flags_ |= F_FILE_DIR_DIRTY;
   return true;
 }
 
@@ -65,9 +91,9 @@ uint8_t SpiSdFile::addDirCluster(void)
 // return pointer to cached entry or null for failure
 dir_t* SpiSdFile::cacheDirEntry(uint8_t action) 
 {
-  if (!SpiSdVolume::cacheRawBlock(dirBlock_, action)) 
+  if (!SpiSdVolume::cacheRawBlock(dirBlock_, action, SpiSdCache::PIN_DIR)) 
     return NULL;
-  return SpiSdVolume::cacheBuffer_.dir + dirIndex_;
+  return SpiSdVolume::cacheBuffer()->dir + dirIndex_;
 }
 
 /**
@@ -103,6 +129,13 @@ uint8_t SpiSdFile::contiguousRange(uint32_t* bgnBlock, uint32_t* endBlock)
   if (firstCluster_ == 0) 
     return false;
 
+  // the clusters of a file without a FAT chain follow each other
+  if (flags_ & F_FILE_NO_CHAIN) {
+    *bgnBlock = vol_->clusterStartBlock(firstCluster_);
+    *endBlock = *bgnBlock + (contigClusters_ << vol_->clusterSizeShift_) - 1;
+    return true;
+  }
+
   for (uint32_t c = firstCluster_; ; c++) {
 
     uint32_t next;
@@ -129,7 +162,7 @@ uint8_t SpiSdFile::contiguousRange(uint32_t* bgnBlock, uint32_t* endBlock)
  *  \note This function only supports short DOS 8.3 names.
  *  \param[in] dirFile The directory where the file will be created.
  *  \param[in] fileName A valid DOS 8.3 file name.
- *  \param[in] size The desired file size.
+ *  \param[in] size The desired file size, over 4 GB only on exFAT.
  *  \return The value one, true, is returned for success and
  * 
  *  the value zero, false, is returned for failure.
@@ -139,7 +172,7 @@ uint8_t SpiSdFile::contiguousRange(uint32_t* bgnBlock, uint32_t* endBlock)
  *  directory is full or an I/O error.
  */
 uint8_t SpiSdFile::createContiguous(SpiSdFile* dirFile
-          ,const char* fileName ,uint32_t size) 
+          ,const char* fileName ,uint64_t size) 
 {
   // don't allow zero length file
   if (size == 0) 
@@ -147,16 +180,28 @@ uint8_t SpiSdFile::createContiguous(SpiSdFile* dirFile
   if (!open(dirFile, fileName, O_CREAT | O_EXCL | O_RDWR)) 
     return false;
 
+  // a FAT directory entry holds a 32-bit size
+  if (vol_->fatType_ != 64 && size > 0XFFFFFFFF) {
+    remove();
+    return false;
+  }
+
   // calculate number of clusters needed
   uint32_t count = ((size - 1) >> (vol_->clusterSizeShift_ + 9)) + 1;
 
-  // allocate clusters
-  if (!vol_->allocContiguous(count, &firstCluster_)) {
+  // allocate clusters, an exFAT file needs no FAT chain for them
+  if (!vol_->allocContiguous(count, &firstCluster_
+         ,!(flags_ & F_FILE_NO_CHAIN))) {
     remove();
     return false;
   }
+  contigClusters_ = count;
+  extentAdd(0, firstCluster_, count);
 
+  // the file holds what is on the card, like a FAT file, so data written
+  // with raw block writes can be read back
   fileSize_ = size;
+  validLength_ = size;
 
   // insure sync() will update dir entry
   flags_ |= F_FILE_DIR_DIRTY;
@@ -170,6 +215,7 @@ uint8_t SpiSdFile::createContiguous(SpiSdFile* dirFile
  *  \return The value one, true, is returned for success and
  * 
  *  the value zero, false, is returned for failure.
+ *  Reasons for failure include an I/O error or an exFAT volume.
  */
 uint8_t SpiSdFile::dirEntry(dir_t* dir) 
 {
@@ -177,6 +223,10 @@ uint8_t SpiSdFile::dirEntry(dir_t* dir)
   if (!sync()) 
     return false;
 
+  // exFAT entry sets have no dir_t
+  if (vol_->fatType_ == 64) 
+    return false;
+
   // read entry
   dir_t* p = cacheDirEntry(SpiSdVolume::CACHE_FOR_READ);
   if (!p) return false;
@@ -205,6 +255,499 @@ void SpiSdFile::dirName(const dir_t& dir, char* name)
   name[j] = 0;
 }
 
+// remember that count clusters from cluster are the file's clusters from
+// index on, ignored unless index is just after the known clusters
+void SpiSdFile::extentAdd(uint32_t index, uint32_t cluster, uint32_t count) 
+{
+#if SPISD_FILE_EXTENTS
+  uint8_t n = extentCount_;
+  if (index != extentKnown()) 
+    return;
+
+  if (n && cluster == extentFind(index - 1) + 1) {
+    // continues the last run
+    extentEnd_[n - 1] += count;
+  } else if (n < SPISD_FILE_EXTENTS) {
+    extentStart_[n] = cluster;
+    extentEnd_[n] = index + count;
+    extentCount_++;
+  }
+#endif  // SPISD_FILE_EXTENTS
+}
+
+// forget all but the first count clusters of the file
+void SpiSdFile::extentCut(uint32_t count) 
+{
+#if SPISD_FILE_EXTENTS
+  while (extentCount_ > 1 && extentEnd_[extentCount_ - 2] >= count) 
+    extentCount_--;
+  if (extentCount_ == 1 && count == 0) 
+    extentCount_ = 0;
+  if (extentCount_ && extentEnd_[extentCount_ - 1] > count) 
+    extentEnd_[extentCount_ - 1] = count;
+#endif  // SPISD_FILE_EXTENTS
+}
+
+// cluster number of the file's cluster index or zero if it is not known
+uint32_t SpiSdFile::extentFind(uint32_t index) const 
+{
+#if SPISD_FILE_EXTENTS
+  uint32_t bgn = 0;
+  for (uint8_t k = 0; k < extentCount_; k++) {
+    if (index < extentEnd_[k]) 
+      return extentStart_[k] + (index - bgn);
+    bgn = extentEnd_[k];
+  }
+#endif  // SPISD_FILE_EXTENTS
+  return 0;
+}
+
+// number of clusters at the start of the file with known numbers
+uint32_t SpiSdFile::extentKnown(void) const 
+{
+#if SPISD_FILE_EXTENTS
+  if (extentCount_) 
+    return extentEnd_[extentCount_ - 1];
+#endif  // SPISD_FILE_EXTENTS
+  return 0;
+}
+
+// cache entry k of the file's exFAT entry set, the entries after the
+// end of the first block are in the block at setBlock_
+dir_t* SpiSdFile::exFatEntry(uint8_t k, uint8_t action) 
+{
+  uint8_t i = dirIndex_ + k;
+  uint32_t block = i < 16 ? dirBlock_ : setBlock_;
+  if (!SpiSdVolume::cacheRawBlock(block, action, SpiSdCache::PIN_DIR)) 
+    return NULL;
+  return SpiSdVolume::cacheBuffer()->dir + (i & 0XF);
+}
+
+// open or create a file by name in an exFAT directory, names are
+// compared with the up-case table of the volume
+uint8_t SpiSdFile::exFatOpen(SpiSdFile* dirFile
+          ,const char* fileName, uint8_t oflag) 
+{
+  uint16_t len = strlen(fileName);
+  if (len == 0 || len > EXFAT_NAME_MAX) 
+    return false;
+
+  vol_ = dirFile->vol_;
+
+  // printable ASCII names without the characters exFAT forbids
+  uint16_t hash = 0;
+  for (uint16_t i = 0; i < len; i++) {
+    uint8_t c = fileName[i];
+    if (c < 0X20 || c > 0X7E || strchr("\"*/:<>?\\|", c)) 
+      return false;
+
+    uint16_t u = vol_->upcase(c);
+    hash = ((hash & 1) ? 0X8000 : 0) + (hash >> 1) + (u & 0XFF);
+    hash = ((hash & 1) ? 0X8000 : 0) + (hash >> 1) + (u >> 8);
+  }
+
+  // file and stream entries and the name entries
+  uint8_t need = 2 + (len + EXFAT_NAME_CHARS - 1) / EXFAT_NAME_CHARS;
+
+  // first run of need free entries
+  uint32_t freePos = 0;
+  uint8_t freeCount = 0;
+
+  dirFile->rewind();
+  while (dirFile->curPosition_ < dirFile->fileSize_) {
+    uint32_t pos = dirFile->curPosition_;
+    dir_t* p = dirFile->readDirCache();
+    if (p == NULL) 
+      return false;
+
+    uint8_t type = p->name[0];
+    if (!(type & EXFAT_TYPE_IN_USE)) {
+      if (freeCount == 0) freePos = pos;
+      if (freeCount < need) freeCount++;
+
+      if (type == EXFAT_TYPE_END) {
+        // every entry after the end mark is free
+        uint32_t rest = (dirFile->fileSize_ - dirFile->curPosition_) >> 5;
+        freeCount = freeCount + rest < need ? freeCount + rest : need;
+        break;
+      }
+      continue;
+    }
+    if (freeCount < need) freeCount = 0;
+    if (type != EXFAT_TYPE_FILE) 
+      continue;
+
+    // the stream entry has the length and hash of the name
+    p = dirFile->readDirCache();
+    if (p == NULL) 
+      return false;
+    exstream_t* sp = reinterpret_cast<exstream_t*>(p);
+    if (sp->type != EXFAT_TYPE_STREAM 
+      || sp->nameLength != len || sp->nameHash != hash) 
+    {
+      continue;
+    }
+
+    // compare the name entries
+    uint16_t i = 0;
+    while (i < len) {
+      exname_t e;
+      p = dirFile->readDirCache();
+      if (p == NULL) 
+        return false;
+      memcpy(&e, p, sizeof(e));
+      if (e.type != EXFAT_TYPE_NAME) 
+        break;
+
+      uint8_t k = 0;
+      while (k < EXFAT_NAME_CHARS && i < len 
+        && vol_->upcase(e.unicode[k]) == vol_->upcase(fileName[i])) {
+        k++;
+        i++;
+      }
+      if (k < EXFAT_NAME_CHARS && i < len) 
+        break;
+    }
+    if (i < len) 
+      continue;
+
+    // don't open existing file if O_CREAT and O_EXCL
+    if ((oflag & (O_CREAT | O_EXCL)) == (O_CREAT | O_EXCL)) 
+      return false;
+
+    return dirFile->seekSet(pos) && exFatOpenSet(dirFile, oflag);
+  }
+
+  // only create file if O_CREAT and O_WRITE
+  if ((oflag & (O_CREAT | O_WRITE)) != (O_CREAT | O_WRITE)) 
+    return false;
+
+  // a run of free entries at the end grows with the directory
+  while (freeCount < need) {
+    if (freeCount == 0) freePos = dirFile->fileSize_;
+    if (!dirFile->seekSet(dirFile->fileSize_) || !dirFile->addDirCluster()) 
+      return false;
+
+    // addDirCluster() moves curCluster_ but not the position
+    dirFile->rewind();
+
+    uint32_t added = 16UL << vol_->clusterSizeShift_;
+    freeCount = freeCount + added < need ? freeCount + added : need;
+  }
+  if (!dirFile->sync()) 
+    return false;
+
+  // write the entry set at freePos
+  if (!dirFile->seekSet(freePos)) 
+    return false;
+  dirIndex_ = 0XF & (freePos >> 5);
+  setBlock_ = 0;
+
+  uint16_t sum = 0;
+  for (uint8_t k = 0; k < need; k++) {
+    dir_t* p = dirFile->readDirCache();
+    if (p == NULL) 
+      return false;
+    SpiSdVolume::cacheSetDirty();
+    memset(p, 0, sizeof(dir_t));
+
+    if (k == 0) {
+      exfile_t* fp = reinterpret_cast<exfile_t*>(p);
+      fp->type = EXFAT_TYPE_FILE;
+      fp->setCount = need - 1;
+      fp->attributes = DIR_ATT_ARCHIVE;
+
+      // set timestamps
+      if (dateTime_) {
+        // call user function, the entry's fields may be unaligned
+        uint16_t date;
+        uint16_t time;
+        dateTime_(&date, &time);
+        fp->createDate = date;
+        fp->createTime = time;
+      } else {
+        // use default date/time
+        fp->createDate = FAT_DEFAULT_DATE;
+        fp->createTime = FAT_DEFAULT_TIME;
+      }
+      fp->modifyDate = fp->accessDate = fp->createDate;
+      fp->modifyTime = fp->accessTime = fp->createTime;
+      dirBlock_ = SpiSdVolume::cacheBlockNumber();
+    } else if (k == 1) {
+      exstream_t* sp = reinterpret_cast<exstream_t*>(p);
+      sp->type = EXFAT_TYPE_STREAM;
+      sp->flags = EXFAT_FLAG_ALLOC_POSSIBLE;
+      sp->nameLength = len;
+      sp->nameHash = hash;
+    } else {
+      exname_t* np = reinterpret_cast<exname_t*>(p);
+      np->type = EXFAT_TYPE_NAME;
+      uint16_t i = (k - 2) * EXFAT_NAME_CHARS;
+      for (uint8_t j = 0; j < EXFAT_NAME_CHARS && i < len; j++) 
+        np->unicode[j] = fileName[i++];
+    }
+
+    if (dirIndex_ + k == 16) 
+      setBlock_ = SpiSdVolume::cacheBlockNumber();
+    sum = exFatChecksum(sum, p, k == 0);
+  }
+
+  dir_t* p = exFatEntry(0, SpiSdVolume::CACHE_FOR_WRITE);
+  if (!p) 
+    return false;
+  reinterpret_cast<exfile_t*>(p)->checksum = sum;
+
+  // force write of the set to SD
+  if (!SpiSdVolume::cacheFlush()) 
+    return false;
+
+  // open the new set
+  return dirFile->seekSet(freePos) && exFatOpenSet(dirFile, oflag);
+}
+
+// open the exFAT entry set at the position of dirFile, dirFile is left
+// after the set
+uint8_t SpiSdFile::exFatOpenSet(SpiSdFile* dirFile, uint8_t oflag) 
+{
+  exfile_t f;
+  exstream_t st;
+  uint16_t sum = 0;
+  memset(&st, 0, sizeof(st));
+
+  vol_ = dirFile->vol_;
+  dirIndex_ = 0XF & (dirFile->curPosition_ >> 5);
+  setBlock_ = 0;
+
+  // the file entry gives the number of entries that follow it
+  uint8_t count = 1;
+  for (uint8_t k = 0; k < count; k++) {
+    dir_t* p = dirFile->readDirCache();
+    if (p == NULL) 
+      return false;
+
+    if (k == 0) {
+      memcpy(&f, p, sizeof(f));
+      if (f.type != EXFAT_TYPE_FILE || f.setCount < 2 
+        || dirIndex_ + f.setCount > 31) 
+      {
+        return false;
+      }
+      count = f.setCount + 1;
+      dirBlock_ = SpiSdVolume::cacheBlockNumber();
+    } else if (k == 1) {
+      memcpy(&st, p, sizeof(st));
+      if (st.type != EXFAT_TYPE_STREAM) 
+        return false;
+    }
+
+    if (dirIndex_ + k == 16) 
+      setBlock_ = SpiSdVolume::cacheBlockNumber();
+    sum = exFatChecksum(sum, p, k == 0);
+  }
+
+  // a damaged set
+  if (sum != f.checksum || st.validLength > st.dataLength) 
+    return false;
+
+  // write or truncate is an error for a directory or read-only file
+  if (f.attributes & (DIR_ATT_READ_ONLY | DIR_ATT_DIRECTORY)) {
+    if (oflag & (O_WRITE | O_TRUNC)) 
+      return false;
+  }
+  type_ = (f.attributes & DIR_ATT_DIRECTORY) 
+        ? FAT_FILE_TYPE_SUBDIR : FAT_FILE_TYPE_NORMAL;
+
+  // save open flags for read/write
+  flags_ = oflag & (O_ACCMODE | O_SYNC | O_APPEND);
+
+  firstCluster_ = st.firstCluster;
+  fileSize_ = st.dataLength;
+  validLength_ = st.validLength;
+
+  // an empty file starts without a FAT chain
+  contigClusters_ = 0;
+  if ((st.flags & EXFAT_FLAG_NO_FAT_CHAIN) || firstCluster_ == 0) {
+    uint8_t shift = vol_->clusterSizeShift_ + 9;
+    flags_ |= F_FILE_NO_CHAIN;
+    if (fileSize_) contigClusters_ = ((fileSize_ - 1) >> shift) + 1;
+  }
+
+  // set to start of file
+  curCluster_ = 0;
+  curPosition_ = 0;
+#if SPISD_FILE_EXTENTS
+  extentCount_ = 0;
+#endif  // SPISD_FILE_EXTENTS
+  if (firstCluster_) 
+    extentAdd(0, firstCluster_, contigClusters_ ? contigClusters_ : 1);
+
+  // truncate file to zero length if requested
+  if (oflag & O_TRUNC) 
+    return truncate(0);
+  return true;
+}
+
+// write the size, first cluster and, if stamp is true, the modify time
+// to the exFAT entry set and update its checksum
+uint8_t SpiSdFile::exFatSync(uint8_t stamp) 
+{
+  // the root has no entry set
+  if (isRoot()) {
+    flags_ &= ~F_FILE_DIR_DIRTY;
+    return true;
+  }
+
+  exstream_t* sp = reinterpret_cast<exstream_t*>(
+                     exFatEntry(1, SpiSdVolume::CACHE_FOR_WRITE));
+  if (!sp) 
+    return false;
+
+  sp->flags = EXFAT_FLAG_ALLOC_POSSIBLE;
+  if (firstCluster_ && (flags_ & F_FILE_NO_CHAIN)) 
+    sp->flags |= EXFAT_FLAG_NO_FAT_CHAIN;
+  sp->firstCluster = firstCluster_;
+  sp->validLength = validLength_;
+  sp->dataLength = fileSize_;
+
+  exfile_t* fp = reinterpret_cast<exfile_t*>(
+                   exFatEntry(0, SpiSdVolume::CACHE_FOR_WRITE));
+  if (!fp) 
+    return false;
+
+  // set modify time if user supplied a callback date/time function
+  if (stamp && dateTime_) {
+    uint16_t date;
+    uint16_t time;
+    dateTime_(&date, &time);
+    fp->modifyDate = fp->accessDate = date;
+    fp->modifyTime = fp->accessTime = time;
+    fp->modify10ms = 0;
+  }
+  uint8_t count = fp->setCount;
+
+  uint16_t sum = 0;
+  for (uint8_t k = 0; k <= count; k++) {
+    dir_t* p = exFatEntry(k, SpiSdVolume::CACHE_FOR_READ);
+    if (!p) 
+      return false;
+    sum = exFatChecksum(sum, p, k == 0);
+  }
+
+  fp = reinterpret_cast<exfile_t*>(
+         exFatEntry(0, SpiSdVolume::CACHE_FOR_WRITE));
+  if (!fp) 
+    return false;
+  fp->checksum = sum;
+
+  // clear directory dirty
+  if (stamp) 
+    flags_ &= ~F_FILE_DIR_DIRTY;
+  return true;
+}
+
+/**
+ *  Get the name of an open file or directory, the 8.3 name on a FAT
+ *  volume and the long name on an exFAT volume where characters that
+ *  are not ASCII read as '?'.  The root directory is "/".
+ *
+ *  \param[out] name Location for the name.
+ *  \param[in] size Size of \a name, a longer name is cut to fit.
+ *  \return The value one, true, is returned for success and
+ *  the value zero, false, is returned for failure.
+ *  Reasons for failure include no file is open or an I/O error.
+ */
+uint8_t SpiSdFile::getName(char* name, uint16_t size) 
+{
+  if (!isOpen() || size == 0) 
+    return false;
+
+  uint16_t n = 0;
+  if (isRoot()) {
+    if (size > 1) name[n++] = '/';
+  } else if (vol_->fatType_ == 64) {
+    dir_t* p = exFatEntry(1, SpiSdVolume::CACHE_FOR_READ);
+    if (!p) 
+      return false;
+    uint8_t len = reinterpret_cast<exstream_t*>(p)->nameLength;
+
+    for (uint8_t i = 0; i < len && n + 1 < size; i++) {
+      p = exFatEntry(2 + i / EXFAT_NAME_CHARS, SpiSdVolume::CACHE_FOR_READ);
+      if (!p) 
+        return false;
+      uint16_t c = reinterpret_cast<exname_t*>(p)->unicode[i % EXFAT_NAME_CHARS];
+      name[n++] = c < 0X80 ? c : '?';
+    }
+  } else {
+    char buf[13];
+    dir_t* p = cacheDirEntry(SpiSdVolume::CACHE_FOR_READ);
+    if (!p) 
+      return false;
+    dirName(*p, buf);
+    for (; buf[n] && n + 1 < size; n++) 
+      name[n] = buf[n];
+  }
+  name[n] = 0;
+  return true;
+}
+
+// allocate the cluster after *cluster, the last cluster of the file or
+// zero, and return it in *cluster.  An exFAT file without a FAT chain
+// keeps none while its clusters follow each other, else its clusters
+// so far are linked first.
+uint8_t SpiSdFile::growChain(uint32_t* cluster) 
+{
+  if (!(flags_ & F_FILE_NO_CHAIN)) 
+    return vol_->allocContiguous(1, cluster);
+
+  uint32_t last = *cluster;
+  uint32_t next = last;
+  if (!vol_->allocContiguous(1, &next, false)) 
+    return false;
+
+  if (last && next != (last + 1)) {
+    if (!vol_->fatLinkRun(firstCluster_, last) 
+      || !vol_->fatPut(last, next) 
+      || !vol_->fatPutEOC(next)) 
+    {
+      return false;
+    }
+    flags_ &= ~F_FILE_NO_CHAIN;
+    flags_ |= F_FILE_DIR_DIRTY;
+  } else {
+    contigClusters_++;
+  }
+  *cluster = next;
+  return true;
+}
+
+// free the clusters that follow tail, the file's cluster index, and
+// make tail the end of the chain, curCluster_ moves back to tail if
+// the position is past it
+uint8_t SpiSdFile::freeTail(uint32_t tail, uint32_t index) 
+{
+  if ((curPosition_ >> (vol_->clusterSizeShift_ + 9)) > index) 
+    curCluster_ = tail;
+
+  if (flags_ & F_FILE_NO_CHAIN) {
+    // only the allocation bitmap knows the clusters past tail
+    uint32_t keep = index + 1;
+    if (!vol_->freeRun(tail + 1, contigClusters_ - keep)) 
+      return false;
+    contigClusters_ = keep;
+  } else {
+    uint32_t next;
+    if (!vol_->fatGet(tail, &next)) 
+      return false;
+
+    if (!vol_->isEOC(next)) {
+      if (!vol_->freeChain(next) || !vol_->fatPutEOC(tail)) 
+        return false;
+    }
+  }
+  extentCut(index + 1);
+  return true;
+}
+
 // format directory name field from a 8.3 name string
 uint8_t SpiSdFile::make83Name(const char* str, uint8_t* name) 
 {
@@ -261,13 +804,14 @@ uint8_t SpiSdFile::make83Name(const char* str, uint8_t* name)
 uint8_t SpiSdFile::makeDir(SpiSdFile* dir, const char* dirName) 
 {
   dir_t d;
+  dir_t* p;
 
   // create a normal file
   if (!open(dir, dirName, O_CREAT | O_EXCL | O_RDWR)) 
     return false;
 
-  // convert SpiSdFile to directory
-  flags_ = O_READ;
+  // convert SpiSdFile to directory, exFAT clusters stay unchained
+  flags_ = O_READ | (flags_ & F_FILE_NO_CHAIN);
   type_ = FAT_FILE_TYPE_SUBDIR;
 
   // allocate and zero first cluster
@@ -278,8 +822,20 @@ uint8_t SpiSdFile::makeDir(SpiSdFile* dir, const char* dirName)
   if (!sync()) 
     return false;
 
+  // an exFAT directory has no '.' and '..' entries
+  if (vol_->fatType_ == 64) {
+    p = exFatEntry(0, SpiSdVolume::CACHE_FOR_WRITE);
+    if (!p) 
+      return false;
+    reinterpret_cast<exfile_t*>(p)->attributes = DIR_ATT_DIRECTORY;
+
+    // sync() puts the new checksum in the set
+    flags_ |= F_FILE_DIR_DIRTY;
+    return sync();
+  }
+
   // cache entry - should already be in cache due to sync() call
-  dir_t* p = cacheDirEntry(SpiSdVolume::CACHE_FOR_WRITE);
+  p = cacheDirEntry(SpiSdVolume::CACHE_FOR_WRITE);
   if (!p) 
     return false;
 
@@ -298,7 +854,7 @@ uint8_t SpiSdFile::makeDir(SpiSdFile* dir, const char* dirName)
     return false;
 
   // copy '.' to block
-  memcpy(&SpiSdVolume::cacheBuffer_.dir[0], &d, sizeof(d));
+  memcpy(&SpiSdVolume::cacheBuffer()->dir[0], &d, sizeof(d));
 
   // make entry for '..'
   d.name[1] = '.';
@@ -311,7 +867,7 @@ uint8_t SpiSdFile::makeDir(SpiSdFile* dir, const char* dirName)
   }
 
   // copy '..' to block
-  memcpy(&SpiSdVolume::cacheBuffer_.dir[1], &d, sizeof(d));
+  memcpy(&SpiSdVolume::cacheBuffer()->dir[1], &d, sizeof(d));
 
   // set position after '..'
   curPosition_ = 2 * sizeof(d);
@@ -320,12 +876,42 @@ uint8_t SpiSdFile::makeDir(SpiSdFile* dir, const char* dirName)
   return SpiSdVolume::cacheFlush();
 }
 
+// replace cluster, the file's cluster index, with the next cluster of
+// the file from the extents or the FAT, an end of chain mark at the end
+uint8_t SpiSdFile::nextCluster(uint32_t index, uint32_t* cluster) 
+{
+  uint32_t c = extentFind(index + 1);
+  if (c) {
+    *cluster = c;
+    return true;
+  }
+
+  // a file without a FAT chain ends after its contiguous clusters
+  if (flags_ & F_FILE_NO_CHAIN) {
+    *cluster = (index + 1) < contigClusters_ 
+             ? firstCluster_ + index + 1 : 0X0FFFFFFF;
+    return true;
+  }
+  uint32_t prev = *cluster;
+  if (!vol_->fatGet(prev, cluster)) 
+    return false;
+
+  // the rest of a run in the same FAT block costs no reads
+  uint32_t n = vol_->fatRunLength(prev);
+  if (n) 
+    extentAdd(index + 1, prev + 1, n);
+  else if (!vol_->isEOC(*cluster)) 
+    extentAdd(index + 1, *cluster);
+  return true;
+}
+
 /**
  *  Open a file or directory by name.
  *
  *  \param[in] dirFile An open SdFat instance for the directory containing the
  *  file to be opened.
- *  \param[in] fileName A valid 8.3 DOS name for a file to be opened.
+ *  \param[in] fileName A valid 8.3 DOS name for a file to be opened, or
+ *  a name of up to 225 printable ASCII characters on an exFAT volume.
  *  \param[in] oflag Values for \a oflag are constructed by a bitwise-inclusive
  *  OR of flags from the following list
  *    O_READ   - Open for reading.
@@ -365,6 +951,10 @@ uint8_t SpiSdFile::open(SpiSdFile* dirFile
   if (isOpen()) 
     return false;
 
+  // exFAT names and entry sets
+  if (dirFile->vol_->fatType_ == 64) 
+    return exFatOpen(dirFile, fileName, oflag);
+
   if (!make83Name(fileName, dname)) 
     return false;
 
@@ -386,7 +976,7 @@ uint8_t SpiSdFile::open(SpiSdFile* dirFile
       if (!emptyFound) {
         emptyFound = true;
         dirIndex_ = index;
-        dirBlock_ = SpiSdVolume::cacheBlockNumber_;
+        dirBlock_ = SpiSdVolume::cacheBlockNumber();
       }
       // done if no entries follow
       if (p->name[0] == DIR_NAME_FREE) 
@@ -423,7 +1013,7 @@ uint8_t SpiSdFile::open(SpiSdFile* dirFile
 
     // use first entry in cluster
     dirIndex_ = 0;
-    p = SpiSdVolume::cacheBuffer_.dir;
+    p = SpiSdVolume::cacheBuffer()->dir;
   }
 
   // initialize as empty file
@@ -477,6 +1067,10 @@ uint8_t SpiSdFile::open(SpiSdFile* dirFile, uint16_t index, uint8_t oflag)
   if (!dirFile->seekSet(32 * index)) 
     return false;
 
+  // index of the file entry of an exFAT entry set
+  if (vol_->fatType_ == 64) 
+    return exFatOpenSet(dirFile, oflag);
+
   // read entry into cache
   dir_t* p = dirFile->readDirCache();
   if (p == NULL) 
@@ -498,7 +1092,7 @@ uint8_t SpiSdFile::open(SpiSdFile* dirFile, uint16_t index, uint8_t oflag)
 uint8_t SpiSdFile::openCachedEntry(uint8_t dirIndex, uint8_t oflag) 
 {
   // location of entry in cache
-  dir_t* p = SpiSdVolume::cacheBuffer_.dir + dirIndex;
+  dir_t* p = SpiSdVolume::cacheBuffer()->dir + dirIndex;
 
   // write or truncate is an error for a directory or read-only file
   if (p->attributes & (DIR_ATT_READ_ONLY | DIR_ATT_DIRECTORY)) {
@@ -508,7 +1102,7 @@ uint8_t SpiSdFile::openCachedEntry(uint8_t dirIndex, uint8_t oflag)
 
   // remember location of directory entry on SD
   dirIndex_ = dirIndex;
-  dirBlock_ = SpiSdVolume::cacheBlockNumber_;
+  dirBlock_ = SpiSdVolume::cacheBlockNumber();
 
   // copy first cluster number for directory fields
   firstCluster_ = (uint32_t)p->firstClusterHigh << 16;
@@ -519,12 +1113,15 @@ uint8_t SpiSdFile::openCachedEntry(uint8_t dirIndex, uint8_t oflag)
     fileSize_ = p->fileSize;
     type_ = FAT_FILE_TYPE_NORMAL;
   } else if (DIR_IS_SUBDIR(p)) {
-    if (!vol_->chainSize(firstCluster_, &fileSize_)) 
+    uint32_t size;
+    if (!vol_->chainSize(firstCluster_, &size)) 
       return false;
+    fileSize_ = size;
     type_ = FAT_FILE_TYPE_SUBDIR;
   } else {
     return false;
   }
+  validLength_ = fileSize_;
 
   // save open flags for read/write
   flags_ = oflag & (O_ACCMODE | O_SYNC | O_APPEND);
@@ -532,6 +1129,10 @@ uint8_t SpiSdFile::openCachedEntry(uint8_t dirIndex, uint8_t oflag)
   // set to start of file
   curCluster_ = 0;
   curPosition_ = 0;
+#if SPISD_FILE_EXTENTS
+  extentCount_ = 0;
+#endif  // SPISD_FILE_EXTENTS
+  if (firstCluster_) extentAdd(0, firstCluster_);
 
   // truncate file to zero length if requested
   if (oflag & O_TRUNC) 
@@ -539,6 +1140,45 @@ uint8_t SpiSdFile::openCachedEntry(uint8_t dirIndex, uint8_t oflag)
   return true;
 }
 
+/**
+ *  Open the next file or subdirectory in a directory, '.' and '..'
+ *  are skipped.
+ *
+ *  \param[in] dirFile An open directory, the search starts at its
+ *  position and leaves it after the entry that is opened.
+ *  \param[in] oflag Values for \a oflag as for open() by index.
+ *  \return The value one, true, is returned for success and
+ *  the value zero, false, is returned for failure.
+ *  Reasons for failure include this SdFile is already open, \a dirFile
+ *  is not a directory, the end of the directory or an I/O error.
+ */
+uint8_t SpiSdFile::openNext(SpiSdFile* dirFile, uint8_t oflag) 
+{
+  if (isOpen() || !dirFile->isDir() || (0X1F & dirFile->curPosition_)) 
+    return false;
+
+  vol_ = dirFile->vol_;
+  while (dirFile->curPosition_ < dirFile->fileSize_) {
+    uint32_t pos = dirFile->curPosition_;
+    dir_t* p = dirFile->readDirCache();
+    if (p == NULL) 
+      return false;
+
+    // done if past last used entry
+    if (p->name[0] == DIR_NAME_FREE) 
+      return false;
+
+    if (vol_->fatType_ == 64) {
+      if (p->name[0] == EXFAT_TYPE_FILE) 
+        return dirFile->seekSet(pos) && exFatOpenSet(dirFile, oflag);
+    } else if (p->name[0] != DIR_NAME_DELETED && p->name[0] != '.' 
+      && DIR_IS_FILE_OR_SUBDIR(p)) {
+      return openCachedEntry(0XF & (pos >> 5), oflag);
+    }
+  }
+  return false;
+}
+
 /**
  *  Open a volume's root directory.
  *
@@ -546,7 +1186,8 @@ uint8_t SpiSdFile::openCachedEntry(uint8_t dirIndex, uint8_t oflag)
  *  \return The value one, true, is returned for success and
  *  the value zero, false, is returned for failure.
  *  Reasons for failure include the FAT volume has not been initialized
- *  or it a FAT12 volume.
+ *  or it a FAT12 volume.  The root of an exFAT volume is a cluster chain
+ *  like the FAT32 root.
  */
 uint8_t SpiSdFile::openRoot(SpiSdVolume* vol) 
 {
@@ -558,14 +1199,17 @@ uint8_t SpiSdFile::openRoot(SpiSdVolume* vol)
     type_ = FAT_FILE_TYPE_ROOT16;
     firstCluster_ = 0;
     fileSize_ = 32 * vol->rootDirEntryCount();
-  } else if (vol->fatType() == 32) {
+  } else if (vol->fatType() == 32 || vol->fatType() == 64) {
     type_ = FAT_FILE_TYPE_ROOT32;
     firstCluster_ = vol->rootDirStart();
-    if (!vol->chainSize(firstCluster_, &fileSize_)) return false;
+    uint32_t size;
+    if (!vol->chainSize(firstCluster_, &size)) return false;
+    fileSize_ = size;
   } else {
     // volume is not initialized or FAT12
     return false;
   }
+  validLength_ = fileSize_;
 
   vol_ = vol;
   // read only
@@ -574,6 +1218,10 @@ uint8_t SpiSdFile::openRoot(SpiSdVolume* vol)
   // set to start of file
   curCluster_ = 0;
   curPosition_ = 0;
+#if SPISD_FILE_EXTENTS
+  extentCount_ = 0;
+#endif  // SPISD_FILE_EXTENTS
+  if (firstCluster_) extentAdd(0, firstCluster_);
 
   // root has no directory entry
   dirBlock_ = 0;
@@ -582,6 +1230,42 @@ uint8_t SpiSdFile::openRoot(SpiSdVolume* vol)
 }
 
 
+// Count the blocks, up to maxCount, from the current position in a physically
+// contiguous run of the file.  curCluster_ is advanced to the cluster
+// that holds the last block of the run.  If tail is not zero clusters are
+// added at the end of the chain, the run ends at the first one that
+// could not be allocated next to its predecessor.  *tail is set to the
+// last cluster of the chain before the first one added, zero if none.
+uint32_t SpiSdFile::runBlocks(uint32_t maxCount, uint32_t* tail) 
+{
+  if (type_ == FAT_FILE_TYPE_ROOT16) 
+    return maxCount;
+
+  uint32_t count = vol_->blocksPerCluster_ - vol_->blockOfCluster(curPosition_);
+  uint32_t index = curPosition_ >> (vol_->clusterSizeShift_ + 9);
+  while (count < maxCount) {
+    uint32_t next = curCluster_;
+    if (!nextCluster(index, &next)) 
+      break;
+
+    if (tail && vol_->isEOC(next)) {
+      next = curCluster_;
+      if (!growChain(&next)) 
+        break;
+      if (!*tail) *tail = curCluster_;
+      extentAdd(index + 1, next);
+    }
+
+    if (next != (curCluster_ + 1)) 
+      break;
+    curCluster_ = next;
+    index++;
+    count += vol_->blocksPerCluster_;
+  }
+
+  return count < maxCount ? count : maxCount;
+}
+
 /**
  *  Read data from a file starting at the current position.
  *
@@ -606,8 +1290,15 @@ int16_t SpiSdFile::read(void* buf, uint16_t nbyte)
   if (nbyte > (fileSize_ - curPosition_)) 
     nbyte = fileSize_ - curPosition_;
 
+  // an exFAT file reads as zero past its valid length
+  uint16_t zeros = 0;
+  if (curPosition_ + nbyte > validLength_) {
+    zeros = curPosition_ < validLength_ 
+          ? curPosition_ + nbyte - validLength_ : nbyte;
+  }
+
   // amount left to read
-  uint16_t toRead = nbyte;
+  uint16_t toRead = nbyte - zeros;
   while (toRead > 0) {
 
     uint32_t block;  // raw device block number
@@ -616,15 +1307,16 @@ int16_t SpiSdFile::read(void* buf, uint16_t nbyte)
       block = vol_->rootDirStart() + (curPosition_ >> 9);
     } else {
 
-      uint8_t blockOfCluster = vol_->blockOfCluster(curPosition_);
+      uint32_t blockOfCluster = vol_->blockOfCluster(curPosition_);
       if (offset == 0 && blockOfCluster == 0) {
         // start of new cluster
         if (curPosition_ == 0) {
           // use first cluster in file
           curCluster_ = firstCluster_;
         } else {
-          // get next cluster from FAT
-          if (!vol_->fatGet(curCluster_, &curCluster_)) 
+          // get next cluster from the extents or the FAT
+          uint32_t index = curPosition_ >> (vol_->clusterSizeShift_ + 9);
+          if (!nextCluster(index - 1, &curCluster_)) 
             return -1;
         }
       }
@@ -638,8 +1330,27 @@ int16_t SpiSdFile::read(void* buf, uint16_t nbyte)
     if (n > (512 - offset)) 
       n = 512 - offset;
 
+    // read a run of whole blocks with one multiple block read
+    if (offset == 0 && toRead >= 1024) {
+      uint32_t count = runBlocks(toRead >> 9, 0);
+      if (count > 1) {
+        // make sure the card has any dirty cached block of the run
+        if (!SpiSdVolume::cacheFlush(block, count)) 
+          return -1;
+
+        if (!vol_->readBlocks(block, count, dst)) 
+          return -1;
+
+        n = count << 9;
+        dst += n;
+        curPosition_ += n;
+        toRead -= n;
+        continue;
+      }
+    }
+
     // no buffering needed if n == 512 or user requests no buffering
-    if ((unbufferedRead() || n == 512) && block != SpiSdVolume::cacheBlockNumber_) 
+    if ((unbufferedRead() || n == 512) && !SpiSdVolume::cacheIsCached(block)) 
     {
       if (!vol_->readData(block, offset, n, dst)) 
         return -1;
@@ -648,7 +1359,7 @@ int16_t SpiSdFile::read(void* buf, uint16_t nbyte)
       // read block to cache and copy data to caller
       if (!SpiSdVolume::cacheRawBlock(block, SpiSdVolume::CACHE_FOR_READ)) 
         return -1;
-      uint8_t* src = SpiSdVolume::cacheBuffer_.data + offset;
+      uint8_t* src = SpiSdVolume::cacheBuffer()->data + offset;
       uint8_t* end = src + n;
       while (src != end) 
         *dst++ = *src++;
@@ -657,7 +1368,12 @@ int16_t SpiSdFile::read(void* buf, uint16_t nbyte)
     curPosition_ += n;
     toRead -= n;
   }
-  
+
+  if (zeros) {
+    memset(dst, 0, zeros);
+    if (!seekSet(curPosition_ + zeros)) 
+      return -1;
+  }
   return nbyte;
 }
 
@@ -669,7 +1385,8 @@ int16_t SpiSdFile::read(void* buf, uint16_t nbyte)
  *  A value of zero will be returned if end of file is reached.
  *  If an error occurs, readDir() returns -1.  Possible errors include
  *  readDir() called before a directory has been opened, this is not
- *  a directory file or an I/O error occurred.
+ *  a directory file, an exFAT directory or an I/O error occurred.
+ *  openNext() lists the files of any directory.
  */
 int8_t SpiSdFile::readDir(dir_t* dir) 
 {
@@ -678,6 +1395,10 @@ int8_t SpiSdFile::readDir(dir_t* dir)
   if (!isDir() || (0X1F & curPosition_)) 
     return -1;
 
+  // exFAT entry sets have no dir_t
+  if (vol_->fatType_ == 64) 
+    return -1;
+
   while ((n = read(dir, sizeof(dir_t))) == sizeof(dir_t)) {
     // last entry if DIR_NAME_FREE
     if (dir->name[0] == DIR_NAME_FREE) 
@@ -713,7 +1434,7 @@ dir_t* SpiSdFile::readDirCache(void)
   curPosition_ += 31;
 
   // return pointer to entry
-  return (SpiSdVolume::cacheBuffer_.dir + i);
+  return (SpiSdVolume::cacheBuffer()->dir + i);
 }
 
 /**
@@ -734,19 +1455,34 @@ uint8_t SpiSdFile::remove(void)
   if (!truncate(0)) 
     return false;
 
-  // cache directory entry
-  dir_t* d = cacheDirEntry(SpiSdVolume::CACHE_FOR_WRITE);
-  if (!d) 
-    return false;
+  if (vol_->fatType_ == 64) {
+    dir_t* p = exFatEntry(0, SpiSdVolume::CACHE_FOR_READ);
+    if (!p) 
+      return false;
 
-  // mark entry deleted
-  d->name[0] = DIR_NAME_DELETED;
+    // mark every entry of the set not in use
+    uint8_t count = reinterpret_cast<exfile_t*>(p)->setCount;
+    for (uint8_t k = 0; k <= count; k++) {
+      p = exFatEntry(k, SpiSdVolume::CACHE_FOR_WRITE);
+      if (!p) 
+        return false;
+      p->name[0] &= ~EXFAT_TYPE_IN_USE;
+    }
+  } else {
+    // cache directory entry
+    dir_t* d = cacheDirEntry(SpiSdVolume::CACHE_FOR_WRITE);
+    if (!d) 
+      return false;
+
+    // mark entry deleted
+    d->name[0] = DIR_NAME_DELETED;
+  }
 
   // set this SpiSdFile closed
   type_ = FAT_FILE_TYPE_CLOSED;
 
-  // write entry to SD
-  return SpiSdVolume::cacheFlush();
+  // write entry and free count to SD
+  return vol_->fsInfoSync() && SpiSdVolume::cacheFlush();
 }
 
 /**
@@ -804,6 +1540,13 @@ uint8_t SpiSdFile::rmDir(void)
     if (p->name[0] == DIR_NAME_FREE) 
       break;
 
+    // error not empty if an exFAT entry is in use
+    if (vol_->fatType_ == 64) {
+      if (p->name[0] & EXFAT_TYPE_IN_USE) 
+        return false;
+      continue;
+    }
+
     // skip empty slot or '.' or '..'
     if (p->name[0] == DIR_NAME_DELETED || p->name[0] == '.') 
       continue;
@@ -851,13 +1594,19 @@ uint8_t SpiSdFile::rmRfStar(void)
     if (p->name[0] == DIR_NAME_FREE) 
       break;
 
-    // skip empty slot or '.' or '..'
-    if (p->name[0] == DIR_NAME_DELETED || p->name[0] == '.') 
-      continue;
+    if (vol_->fatType_ == 64) {
+      // only the file entry of an exFAT entry set is opened
+      if (p->name[0] != EXFAT_TYPE_FILE) 
+        continue;
+    } else {
+      // skip empty slot or '.' or '..'
+      if (p->name[0] == DIR_NAME_DELETED || p->name[0] == '.') 
+        continue;
 
-    // skip if part of long file name or volume label in root
-    if (!DIR_IS_FILE_OR_SUBDIR(p)) 
-      continue;
+      // skip if part of long file name or volume label in root
+      if (!DIR_IS_FILE_OR_SUBDIR(p)) 
+        continue;
+    }
 
     if (!f.open(this, index, O_READ)) 
       return false;
@@ -892,7 +1641,7 @@ uint8_t SpiSdFile::rmRfStar(void)
  *  \return The value one, true, is returned for success and
  *  the value zero, false, is returned for failure.
  */
-uint8_t SpiSdFile::seekSet(uint32_t pos) 
+uint8_t SpiSdFile::seekSet(uint64_t pos) 
 {
   // error if file not open or seek past end of file
   if (!isOpen() || pos > fileSize_) 
@@ -913,18 +1662,41 @@ uint8_t SpiSdFile::seekSet(uint32_t pos)
   uint32_t nCur = (curPosition_ - 1) >> (vol_->clusterSizeShift_ + 9);
   uint32_t nNew = (pos - 1) >> (vol_->clusterSizeShift_ + 9);
 
-  if (nNew < nCur || curPosition_ == 0) {
-    // must follow chain from first cluster
-    curCluster_ = firstCluster_;
-  } else {
-    // advance from curPosition
-    nNew -= nCur;
+  // the clusters of a file without a FAT chain follow each other
+  if (flags_ & F_FILE_NO_CHAIN) {
+    curCluster_ = firstCluster_ + nNew;
+    curPosition_ = pos;
+    return true;
+  }
+
+  // start at the last known cluster before the new position
+  uint32_t index = 0;
+  uint32_t cluster = firstCluster_;
+  uint32_t known = extentKnown();
+  if (known) {
+    index = known > nNew ? nNew : known - 1;
+    cluster = extentFind(index);
+  }
+
+  // advance from curPosition if it is closer
+  if (curPosition_ != 0 && nCur > index && nCur <= nNew) {
+    index = nCur;
+    cluster = curCluster_;
   }
 
-  while (nNew--) {
-    if (!vol_->fatGet(curCluster_, &curCluster_)) 
+  // a walk over more than a FAT block streams the FAT from the card
+  uint32_t perBlock = vol_->fatType_ == 16 ? 256 : 128;
+  if ((nNew - index) > perBlock && !SpiSdVolume::fatInRam()) {
+    if (!walkChain(index, &cluster, nNew - index)) 
       return false;
+    index = nNew;
   }
+
+  for (; index < nNew; index++) {
+    if (!nextCluster(index, &cluster)) 
+      return false;
+  }
+  curCluster_ = cluster;
   curPosition_ = pos;
   return true;
 }
@@ -944,20 +1716,36 @@ uint8_t SpiSdFile::sync(void)
   if (!isOpen()) 
     return false;
 
-  if (flags_ & F_FILE_DIR_DIRTY) {
+  if ((flags_ & F_FILE_DIR_DIRTY) && !syncDirEntry(true)) 
+    return false;
 
-    dir_t* d = cacheDirEntry(SpiSdVolume::CACHE_FOR_WRITE);
-    if (!d) 
-      return false;
+  // also check the last block of a write-behind card
+  return vol_->fsInfoSync()
+      && SpiSdVolume::cacheFlush()
+      && SpiSdVolume::sdCard()->writeFinish();
+}
+
+// copy the size and first cluster to the cached directory entry, with
+// stamp true also set the modify time and mark the entry clean
+uint8_t SpiSdFile::syncDirEntry(uint8_t stamp) 
+{
+  // an exFAT entry set has its own layout and a checksum
+  if (vol_->fatType_ == 64) 
+    return exFatSync(stamp);
+
+  dir_t* d = cacheDirEntry(SpiSdVolume::CACHE_FOR_WRITE);
+  if (!d) 
+    return false;
 
-    // do not set filesize for dir files
-    if (!isDir()) 
-      d->fileSize = fileSize_;
+  // do not set filesize for dir files
+  if (!isDir()) 
+    d->fileSize = fileSize_;
 
-    // update first cluster fields
-    d->firstClusterLow = firstCluster_ & 0XFFFF;
-    d->firstClusterHigh = firstCluster_ >> 16;
+  // update first cluster fields
+  d->firstClusterLow = firstCluster_ & 0XFFFF;
+  d->firstClusterHigh = firstCluster_ >> 16;
 
+  if (stamp) {
     // set modify time if user supplied a callback date/time function
     if (dateTime_) {
       dateTime_(&d->lastWriteDate, &d->lastWriteTime);
@@ -966,8 +1754,7 @@ uint8_t SpiSdFile::sync(void)
     // clear directory dirty
     flags_ &= ~F_FILE_DIR_DIRTY;
   }
-
-  return SpiSdVolume::cacheFlush();
+  return true;
 }
 
 /**
@@ -1009,12 +1796,42 @@ uint8_t SpiSdFile::timestamp(uint8_t flags, uint16_t year, uint8_t month
     return false;
   }
 
+  uint16_t dirDate = FAT_DATE(year, month, day);
+  uint16_t dirTime = FAT_TIME(hour, minute, second);
+
+  if (vol_->fatType_ == 64) {
+    // the root has no entry set
+    if (isRoot()) 
+      return false;
+
+    exfile_t* f = reinterpret_cast<exfile_t*>(
+                    exFatEntry(0, SpiSdVolume::CACHE_FOR_WRITE));
+    if (!f) 
+      return false;
+
+    if (flags & T_ACCESS) {
+      f->accessDate = dirDate;
+      f->accessTime = dirTime;
+    }
+    if (flags & T_CREATE) {
+      f->createDate = dirDate;
+      f->createTime = dirTime;
+      f->create10ms = second & 1 ? 100 : 0;
+    }
+    if (flags & T_WRITE) {
+      f->modifyDate = dirDate;
+      f->modifyTime = dirTime;
+      f->modify10ms = second & 1 ? 100 : 0;
+    }
+
+    // sync() puts the new checksum in the set
+    flags_ |= F_FILE_DIR_DIRTY;
+    return sync();
+  }
+
   dir_t* d = cacheDirEntry(SpiSdVolume::CACHE_FOR_WRITE);
   if (!d) 
     return false;
-
-  uint16_t dirDate = FAT_DATE(year, month, day);
-  uint16_t dirTime = FAT_TIME(hour, minute, second);
   if (flags & T_ACCESS) {
     d->lastAccessDate = dirDate;
   }
@@ -1047,7 +1864,7 @@ uint8_t SpiSdFile::timestamp(uint8_t flags, uint16_t year, uint8_t month
  *  Reasons for failure include file is read only, file is a directory,
  *  \a length is greater than the current file size or an I/O error occurs.
  */
-uint8_t SpiSdFile::truncate(uint32_t length) 
+uint8_t SpiSdFile::truncate(uint64_t length) 
 {
   // error if not a normal file or read-only
   if (!isFile() || !(flags_ & O_WRITE)) 
@@ -1062,17 +1879,31 @@ uint8_t SpiSdFile::truncate(uint32_t length)
     return true;
 
   // remember position for seek after truncation
-  uint32_t newPos = curPosition_ > length ? length : curPosition_;
+  uint64_t newPos = curPosition_ > length ? length : curPosition_;
 
   // position to last cluster in truncated file
   if (!seekSet(length)) 
     return false;
 
-  if (length == 0) {
+  uint8_t shift = vol_->clusterSizeShift_ + 9;
+  if (flags_ & F_FILE_NO_CHAIN) {
+    // only the allocation bitmap knows the clusters past the new end
+    uint32_t keep = length ? ((length - 1) >> shift) + 1 : 0;
+    if (!vol_->freeRun(firstCluster_ + keep, contigClusters_ - keep)) 
+      return false;
+    contigClusters_ = keep;
+    if (keep == 0) firstCluster_ = 0;
+  } else if (length == 0) {
     // free all clusters
     if (!vol_->freeChain(firstCluster_)) 
       return false;
     firstCluster_ = 0;
+
+    // an empty exFAT file starts over without a FAT chain
+    if (vol_->fatType_ == 64) {
+      flags_ |= F_FILE_NO_CHAIN;
+      contigClusters_ = 0;
+    }
   } else {
     uint32_t toFree;
     if (!vol_->fatGet(curCluster_, &toFree)) 
@@ -1090,6 +1921,10 @@ uint8_t SpiSdFile::truncate(uint32_t length)
   }
 
   fileSize_ = length;
+  if (validLength_ > length) validLength_ = length;
+
+  // forget runs past the new end of the chain
+  extentCut(length ? ((length - 1) >> shift) + 1 : 0);
 
   // need to update directory entry
   flags_ |= F_FILE_DIR_DIRTY;
@@ -1097,10 +1932,95 @@ uint8_t SpiSdFile::truncate(uint32_t length)
   if (!sync()) 
     return false;
 
+  // erase the freed clusters, a failed erase only leaves data behind
+  if (vol_->discard() == SD_DISCARD_NOW) 
+    vol_->discardFlush();
+
   // set file to correct position
   return seekSet(newPos);
 }
 
+// follow count links of the chain from cluster, the file's cluster
+// index, with multiple block reads of the FAT while the chain moves
+// forward, the clusters passed are added to the extents
+uint8_t SpiSdFile::walkChain(uint32_t index, uint32_t* cluster
+          ,uint32_t count) 
+{
+  cache_t buf;
+  uint8_t shift = vol_->fatType_ == 16 ? 8 : 7;
+  uint32_t c = *cluster;
+  SpiSd2Card* card = SpiSdVolume::sdCard();
+
+  // the card must have the current FAT
+  if (!SpiSdVolume::fatCache_.flush()) 
+    return false;
+
+  while (count) {
+    uint32_t i = c >> shift;
+    if (!card->readStart(vol_->fatStartBlock_ + i)) 
+      return false;
+
+    // read on while the next link is at most a few blocks ahead
+    uint8_t ok = true;
+    for (;;) {
+      if (!card->readData(buf.data)) {
+        ok = false;
+        break;
+      }
+      while (count && (c >> shift) == i) {
+        c = vol_->fatEntry(&buf, c);
+        if (c < 2 || c > (vol_->clusterCount_ + 1)) {
+          ok = false;
+          break;
+        }
+        extentAdd(++index, c);
+        count--;
+      }
+      if (!ok || !count 
+        || (c >> shift) < i || (c >> shift) > (i + WALK_MAX_GAP)) {
+        break;
+      }
+      i++;
+    }
+    if (!card->readStop() || !ok) 
+      return false;
+  }
+  *cluster = c;
+  return true;
+}
+
+// write zeros from validLength_ to the current position of an exFAT
+// file, its clusters are allocated but the card may hold old data there
+uint8_t SpiSdFile::zeroFill(void) 
+{
+  uint64_t end = curPosition_;
+  uint64_t pos = validLength_;
+  while (pos < end) {
+    // seekSet() leaves curCluster_ at the cluster of the byte before
+    if (!seekSet(pos + 1)) 
+      return false;
+
+    uint32_t block = vol_->clusterStartBlock(curCluster_) 
+                   + vol_->blockOfCluster(pos);
+    uint16_t offset = pos & 0X1FF;
+    uint16_t n = 512 - offset;
+    if (n > end - pos) n = end - pos;
+
+    if (offset == 0) {
+      if (!SpiSdVolume::cacheZeroBlock(block)) 
+        return false;
+    } else {
+      if (!SpiSdVolume::cacheRawBlock(block, SpiSdVolume::CACHE_FOR_WRITE)) 
+        return false;
+      memset(SpiSdVolume::cacheBuffer()->data + offset, 0, n);
+    }
+    pos += n;
+  }
+  validLength_ = end;
+  flags_ |= F_FILE_DIR_DIRTY;
+  return seekSet(end);
+}
+
 /**
  *  Write data to an open file.
  *
@@ -1122,6 +2042,14 @@ size_t SpiSdFile::write(const uint8_t* src, uint32_t nbyte)
   // number of bytes left to write  -  must be before goto statements
   uint32_t nToWrite = nbyte;
 
+  // block of the first byte, for the write-back policy
+  uint32_t startBlock = curPosition_ >> 9;
+
+  // last cluster of the chain before clusters were added for the data
+  // being written and its index in the file, tail is zero if none
+  uint32_t tail = 0;
+  uint32_t tailIndex = 0;
+
   // error if not a normal file or is read-only
   if (!isFile() || !(flags_ & O_WRITE)) 
     goto writeErrorReturn;
@@ -1132,8 +2060,18 @@ size_t SpiSdFile::write(const uint8_t* src, uint32_t nbyte)
       goto writeErrorReturn;
   }
 
+  // a FAT directory entry holds a 32-bit size
+  if (vol_->fatType_ != 64 && curPosition_ + nbyte > 0XFFFFFFFF) 
+    goto writeErrorReturn;
+
+  // bytes past the valid length of an exFAT file must read as zero
+  // once the valid length moves past them
+  if (curPosition_ > validLength_ && nbyte && !zeroFill()) 
+    goto writeErrorReturn;
+
   while (nToWrite > 0) {
-    uint8_t blockOfCluster = vol_->blockOfCluster(curPosition_);
+    tail = 0;
+    uint32_t blockOfCluster = vol_->blockOfCluster(curPosition_);
     uint16_t blockOffset = curPosition_ & 0X1FF;
     if (blockOfCluster == 0 && blockOffset == 0) {
       // start of new cluster
@@ -1142,20 +2080,25 @@ size_t SpiSdFile::write(const uint8_t* src, uint32_t nbyte)
         if (firstCluster_ == 0) {
           // allocate first cluster of file
           if (!addCluster()) goto writeErrorReturn;
+          extentAdd(0, curCluster_);
         } else {
           curCluster_ = firstCluster_;
         }
 
       } else {
 
-        uint32_t next;
-        if (!vol_->fatGet(curCluster_, &next)) 
+        uint32_t index = curPosition_ >> (vol_->clusterSizeShift_ + 9);
+        uint32_t next = curCluster_;
+        if (!nextCluster(index - 1, &next)) 
           return false;
 
         if (vol_->isEOC(next)) {
           // add cluster if at end of chain
+          tail = curCluster_;
+          tailIndex = index - 1;
           if (!addCluster()) 
             goto writeErrorReturn;
+          extentAdd(index, curCluster_);
 
         } else {
           curCluster_ = next;
@@ -1171,37 +2114,58 @@ size_t SpiSdFile::write(const uint8_t* src, uint32_t nbyte)
 
     // block for data write
     uint32_t block = vol_->clusterStartBlock(curCluster_) + blockOfCluster;
-    if (n == 512) {
+
+    // full blocks in a contiguous run starting at block
+    uint32_t count = 0;
+    uint32_t runCluster = curCluster_;
+    if (blockOffset == 0 && nToWrite >= 1024) {
+      uint32_t grown = 0;
+      count = runBlocks(nToWrite >> 9, &grown);
+      if (grown && !tail) {
+        tail = grown;
+        tailIndex = (curPosition_ >> (vol_->clusterSizeShift_ + 9)) 
+                  + (grown - runCluster);
+      }
+    }
+
+    if (count > 1) {
+      // several full blocks - stream them with one multiple block write
+      n = count << 9;
+      SpiSdVolume::cacheInvalidate(block, count);
+
+      if (!vol_->writeBlocks(block, count, src)) {
+        curCluster_ = runCluster;
+        goto writeDataError;
+      }
+      src += n;
+    } else if (n == 512) {
       // full block - don't need to use cache
       // invalidate cache if block is in cache
-      if (SpiSdVolume::cacheBlockNumber_ == block) {
-        SpiSdVolume::cacheBlockNumber_ = 0XFFFFFFFF;
-      }
+      SpiSdVolume::cacheInvalidate(block, 1);
 
       if (!vol_->writeBlock(block, src)) 
-        goto writeErrorReturn;
+        goto writeDataError;
       src += 512;
     } else {
 
-      if (blockOffset == 0 && curPosition_ >= fileSize_) {
+      if (blockOffset == 0 && curPosition_ >= validLength_) {
 	digitalWrite(LED1, HIGH);
         // start of new block don't need to read into cache
-        if (!SpiSdVolume::cacheFlush()) 
+        if (!SpiSdVolume::cacheRawBlock(block
+               ,SpiSdVolume::CACHE_RESERVE_FOR_WRITE, SpiSdCache::PIN_TAIL)) 
           goto writeErrorReturn;
-
-        SpiSdVolume::cacheBlockNumber_ = block;
-        SpiSdVolume::cacheSetDirty();
 	digitalWrite(LED1, LOW);
 
       } else {
 	digitalWrite(LED2, HIGH);
         // rewrite part of block
-        if (!SpiSdVolume::cacheRawBlock(block, SpiSdVolume::CACHE_FOR_WRITE)) 
+        if (!SpiSdVolume::cacheRawBlock(block
+               ,SpiSdVolume::CACHE_FOR_WRITE, SpiSdCache::PIN_TAIL)) 
           goto writeErrorReturn;
 	digitalWrite(LED2, LOW);
       }
 
-      uint8_t* dst = SpiSdVolume::cacheBuffer_.data + blockOffset;
+      uint8_t* dst = SpiSdVolume::cacheBuffer()->data + blockOffset;
       uint8_t* end = dst + n;
       while (dst != end) { 
         *dst++ = *src++;
@@ -1212,6 +2176,12 @@ size_t SpiSdFile::write(const uint8_t* src, uint32_t nbyte)
     curPosition_ += n;
   }
 
+  if (curPosition_ > validLength_) {
+    // the data written is valid, sync() writes the new length
+    validLength_ = curPosition_;
+    flags_ |= F_FILE_DIR_DIRTY;
+  }
+
   if (curPosition_ > fileSize_) {
     // update fileSize and insure sync will update dir entry
     fileSize_ = curPosition_;
@@ -1226,10 +2196,28 @@ size_t SpiSdFile::write(const uint8_t* src, uint32_t nbyte)
   if (flags_ & O_SYNC) {
     if (!sync()) 
       goto writeErrorReturn;
+
+  } else if (vol_->writeBackDue()) {
+    // a batch flush also writes the size and first cluster
+    if ((flags_ & F_FILE_DIR_DIRTY) && !syncDirEntry(false)) 
+      goto writeErrorReturn;
+    if (!vol_->flush()) 
+      goto writeErrorReturn;
+
+  } else if ((SpiSdVolume::flushDirty_ || SpiSdVolume::flushMs_) 
+    && (flags_ & F_FILE_DIR_DIRTY) 
+    && (startBlock != (curPosition_ >> 9) || !(curPosition_ & 0X1FF))) {
+    // keep the entry current to a block so tick() writes the new size
+    if (!syncDirEntry(false)) 
+      goto writeErrorReturn;
   }
 
   return nbyte;
 
+writeDataError:
+  // clusters added for the blocks that failed hold no data
+  if (tail) freeTail(tail, tailIndex);
+
 writeErrorReturn:
   setWriteError();
   digitalWrite(LED0, HIGH);
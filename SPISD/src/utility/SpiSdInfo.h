@@ -33,14 +33,20 @@
 #define CMD0  0X00
 /** SEND_IF_COND - verify SD Memory Card interface operating condition.*/
 #define CMD8  0X08
+/** SWITCH_FUNC - check or switch card functions such as high speed mode */
+#define CMD6  0X06
 /** SEND_CSD - read the Card Specific Data (CSD register) */
 #define CMD9  0X09
 /** SEND_CID - read the card identification information (CID register) */
 #define CMD10 0X0A
+/** STOP_TRANSMISSION - end multiple block read sequence */
+#define CMD12 0X0C
 /** SEND_STATUS - read the card status register */
 #define CMD13 0X0D
 /** READ_BLOCK - read a single data block from the card */
 #define CMD17 0X11
+/** READ_MULTIPLE_BLOCK - read blocks of data until a STOP_TRANSMISSION */
+#define CMD18 0X12
 /** WRITE_BLOCK - write a single data block to the card */
 #define CMD24 0X18
 /** WRITE_MULTIPLE_BLOCK - write blocks of data until a STOP_TRANSMISSION */
@@ -58,6 +64,10 @@
 #define CMD55 0X37
 /** READ_OCR - read the OCR register of a card */
 #define CMD58 0X3A
+/** CRC_ON_OFF - turn the CRC check of commands and data on or off */
+#define CMD59 0X3B
+/** SD_STATUS - read the 64 byte SD Status register */
+#define ACMD13 0X0D
 /** 
  * SET_WR_BLK_ERASE_COUNT - Set the number of write blocks to be
  *  pre-erased before writing 
@@ -68,6 +78,8 @@
  * activates the card's initialization process 
  */
 #define ACMD41 0X29
+/** SEND_SCR - read the SD Configuration Register */
+#define ACMD51 0X33
 
 /** status for card in the ready state */
 #define R1_READY_STATE      0X00
@@ -75,6 +87,8 @@
 #define R1_IDLE_STATE       0X01
 /** status bit for illegal command */
 #define R1_ILLEGAL_COMMAND  0X04
+/** status bit for a command received with a bad CRC */
+#define R1_COM_CRC_ERROR    0X08
 /** start data token for read or write single block*/
 #define DATA_START_BLOCK    0XFE
 /** stop token for write multiple blocks*/
@@ -85,6 +99,8 @@
 #define DATA_RES_MASK       0X1F
 /** write data accepted token */
 #define DATA_RES_ACCEPTED   0X05
+/** write data rejected due to a CRC error token */
+#define DATA_RES_CRC_ERROR  0X0B
 
 typedef struct CID {
   // byte 0
@@ -233,4 +249,35 @@ union csd_t {
   csd2_t v2;
 };
 
+/**
+ * Card capabilities, the raw SCR and SD Status registers and the values
+ * decoded from them and from the CSD.
+ */
+typedef struct SdCardInfo {
+  /** raw SD Configuration Register, zero if the card did not send it */
+  uint8_t scr[8];
+  /** raw SD Status register, zero if the card did not send it */
+  uint8_t sdStatus[64];
+  /** physical layer version times ten: 10, 11, 20, 30 or 40 */
+  uint8_t sdSpec;
+  /** speed class in MB/s: 0, 2, 4, 6 or 10 */
+  uint8_t speedClass;
+  /** UHS speed grade: 0, 1 or 3 */
+  uint8_t uhsGrade;
+  /** video speed class in MB/s, zero if not supported */
+  uint8_t videoClass;
+  /** allocation unit size in 512 byte blocks, zero if not reported */
+  uint32_t auBlocks;
+  /** number of AUs erased in eraseTimeout seconds, zero if not reported */
+  uint16_t eraseSize;
+  /** erase timeout in seconds for eraseSize AUs */
+  uint8_t eraseTimeout;
+  /** seconds added to an erase timeout */
+  uint8_t eraseOffset;
+  /** read timeout in milliseconds */
+  uint16_t readTimeout;
+  /** write timeout in milliseconds */
+  uint16_t writeTimeout;
+} card_info_t;
+
 #endif  // SdInfo_h
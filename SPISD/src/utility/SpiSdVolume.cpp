@@ -20,15 +20,141 @@
 #include "SpiSdFat.h"
 
 // raw block cache
-// init cacheBlockNumber_to invalid SD block number
-uint32_t SpiSdVolume::cacheBlockNumber_ = 0XFFFFFFFF;
-cache_t  SpiSdVolume::cacheBuffer_;     // 512 byte cache for Sd2Card
+SpiSdCacheEntry SpiSdVolume::cacheEntry_[SPISD_CACHE_BLOCKS];
+SpiSdCache SpiSdVolume::cache_(cacheEntry_, SPISD_CACHE_BLOCKS);
+SpiSdCacheEntry SpiSdVolume::fatCacheEntry_[SPISD_FAT_CACHE_BLOCKS];
+SpiSdCache SpiSdVolume::fatCache_(fatCacheEntry_, SPISD_FAT_CACHE_BLOCKS);
+uint8_t SpiSdVolume::fatWriteBack_ = true;
+uint8_t SpiSdVolume::mirrorDefer_ = false;
+uint32_t SpiSdVolume::mirrorFirst_ = 0XFFFFFFFF;  // no FAT blocks to copy
+uint32_t SpiSdVolume::mirrorLast_ = 0;
+uint32_t SpiSdVolume::mirrorOffset_;
+uint8_t SpiSdVolume::mirrorCopies_;
+cache_t* SpiSdVolume::fatRam_ = 0;       // no FAT in RAM
+uint8_t* SpiSdVolume::fatRamDirty_ = 0;
+uint32_t SpiSdVolume::fatRamBlocks_ = 0;
+uint32_t SpiSdVolume::fatRamStart_;
+uint8_t SpiSdVolume::fatRamChanged_ = false;
+uint32_t SpiSdVolume::fatRamMax_ = 0;
+uint8_t SpiSdVolume::flushDirty_ = 0;    // write only at sync points
+uint32_t SpiSdVolume::flushMs_ = 0;
+uint32_t SpiSdVolume::dirtySince_ = 0;
+
+// FAT blocks this far apart are copied as separate ranges
+#define MIRROR_MAX_GAP 8
 SpiSd2Card* SpiSdVolume::sdCard_;       // pointer to SD card object
-uint8_t  SpiSdVolume::cacheDirty_ = 0;  // cacheFlush() will write block if true
-uint32_t SpiSdVolume::cacheMirrorBlock_ = 0;  // mirror  block for second FAT
 
-// find a contiguous group of clusters
-uint8_t SpiSdVolume::allocContiguous(uint32_t count, uint32_t* curCluster) 
+// count the free clusters in the exFAT allocation bitmap with one
+// multiple block read, 0XFFFFFFFF for an I/O error
+uint32_t SpiSdVolume::allocBitmapCount(void) 
+{
+  cache_t buf;
+  uint32_t blocks = (clusterCount_ + 4095) >> 12;
+  uint32_t n = 0;
+  uint32_t i = 0;
+
+  // the card must have the current bitmap
+  if (!cache_.flush(allocBitmapStart_, blocks)) 
+    return 0XFFFFFFFF;
+
+  for (uint8_t retry = 0; ; retry++) {
+    if (sdCard_->readStart(allocBitmapStart_ + i)) {
+      for (; i < blocks; i++) {
+        if (!sdCard_->readData(buf.data)) 
+          break;
+
+        // 4096 clusters per block, bits past the last cluster don't count
+        uint32_t bits = clusterCount_ - (i << 12);
+        if (bits > 4096) bits = 4096;
+        for (uint16_t k = 0; k < bits; k += 32) {
+          uint32_t w = buf.fat32[k >> 5];
+          if (bits - k < 32) w |= 0XFFFFFFFF << (bits - k);
+          n += 32 - __builtin_popcount(w);
+        }
+      }
+      uint8_t stopped = sdCard_->readStop();
+      if (i == blocks) 
+        return stopped ? n : 0XFFFFFFFF;
+    }
+    // continue with the failed block
+    if (!sdCard_->useCrc() || retry >= SD_CRC_RETRIES) 
+      return 0XFFFFFFFF;
+  }
+}
+
+// first cluster of count free clusters in a row from cluster from on in
+// the exFAT allocation bitmap, zero if there are none or for an I/O error
+uint32_t SpiSdVolume::allocBitmapFind(uint32_t from, uint32_t count) 
+{
+  uint32_t end = clusterCount_ + 2;
+  uint32_t run = 0;
+  const cache_t* pc = 0;
+
+  for (uint32_t c = from; c < end;) {
+    // bit c - 2 of the bitmap, 4096 bits per block
+    uint32_t bit = c - 2;
+    if (!pc || (bit & 0XFFF) == 0) {
+      pc = cache_.fetch(allocBitmapStart_ + (bit >> 12), CACHE_FOR_READ);
+      if (!pc) 
+        return 0;
+    }
+    uint8_t b = pc->data[(bit >> 3) & 0X1FF];
+
+    // a byte at a time while aligned
+    if ((bit & 7) == 0 && (b == 0XFF || (b == 0 && c + 8 <= end))) {
+      if (b) {
+        run = 0;
+      } else if ((run += 8) >= count) {
+        return c + 8 - run;
+      }
+      c += 8;
+      continue;
+    }
+
+    if (b & (1 << (bit & 7))) {
+      run = 0;
+    } else if (++run == count) {
+      return c + 1 - count;
+    }
+    c++;
+  }
+  return 0;
+}
+
+// mark count clusters from cluster on used or free in the exFAT
+// allocation bitmap, a byte at a time where the run allows
+uint8_t SpiSdVolume::allocBitmapSet(uint32_t cluster, uint32_t count
+          ,uint8_t used) 
+{
+  uint32_t bit = cluster - 2;
+
+  while (count) {
+    cache_t* pc = cache_.fetch(allocBitmapStart_ + (bit >> 12)
+                    ,CACHE_FOR_WRITE);
+    if (!pc) 
+      return false;
+
+    // the bits of the run in this block
+    do {
+      uint8_t* p = pc->data + ((bit >> 3) & 0X1FF);
+      uint8_t m = (bit & 7) == 0 && count >= 8 ? 0XFF : 1 << (bit & 7);
+      uint8_t n = __builtin_popcount(m & (used ? ~*p : *p));
+      *p = used ? *p | m : *p & ~m;
+      if (freeCount_ != 0XFFFFFFFF) 
+        freeCount_ += used ? -n : n;
+
+      uint8_t k = m == 0XFF ? 8 : 1;
+      bit += k;
+      count -= k;
+    } while (count && (bit & 0XFFF));
+  }
+  return true;
+}
+
+// find a contiguous group of clusters, they are linked in the FAT if
+// chain is true, the exFAT bitmap alone records an unchained group
+uint8_t SpiSdVolume::allocContiguous(uint32_t count, uint32_t* curCluster
+          ,uint8_t chain) 
 {
   // start of group
   uint32_t bgnCluster;
@@ -58,43 +184,57 @@ uint8_t SpiSdVolume::allocContiguous(uint32_t count, uint32_t* curCluster)
   // last cluster of FAT
   uint32_t fatEnd = clusterCount_ + 1;
 
-  // search the FAT for free clusters
-  for (uint32_t n = 0;; n++, endCluster++) {
-    // can't find space checked all clusters
-    if (n >= clusterCount_) return false;
-
-    // past end - start from beginning of FAT
-    if (endCluster > fatEnd) {
-      bgnCluster = endCluster = 2;
-    }
-
-    uint32_t f;
-    if (!fatGet(endCluster, &f)) return false;
-
-    if (f != 0) {
-      // cluster in use try next cluster as bgnCluster
-      bgnCluster = endCluster + 1;
-
-    } else if ((endCluster - bgnCluster + 1) == count) {
-      // done - found space
-      break;
+  if (fatType_ == 64) {
+    // search the exFAT allocation bitmap, from the start if none found
+    uint32_t c = allocBitmapFind(bgnCluster, count);
+    if (!c) c = allocBitmapFind(2, count);
+    if (!c || !allocBitmapSet(c, count, true)) return false;
+    bgnCluster = c;
+    endCluster = c + count - 1;
+  } else if (bitmap_) {
+    // search the bitmap, from the start of the FAT if none found
+    uint32_t c = bitmapFind(bgnCluster, fatEnd + 1, count);
+    if (!c) c = bitmapFind(2, fatEnd + 1, count);
+    if (!c) return false;
+    bgnCluster = c;
+    endCluster = c + count - 1;
+  } else {
+    // search the FAT for free clusters
+    for (uint32_t n = 0; ; n++, endCluster++) {
+      // can't find space checked all clusters
+      if (n >= clusterCount_) return false;
+
+      // past end - start from beginning of FAT
+      if (endCluster > fatEnd) {
+        bgnCluster = endCluster = 2;
+      }
+
+      uint32_t f;
+      if (!fatGet(endCluster, &f)) return false;
+
+      if (f != 0) {
+        // cluster in use try next cluster as bgnCluster
+        bgnCluster = endCluster + 1;
+
+      } else if ((endCluster - bgnCluster + 1) == count) {
+        // done - found space
+        break;
+      }
     }
   }
 
-  // mark end of chain
-  if (!fatPutEOC(endCluster)) return false;
+  // the clusters will hold new data, don't erase them later
+  if (discardCount_) discardCancel(bgnCluster, endCluster);
 
-  // link clusters
-  while (endCluster > bgnCluster) {
-    if (!fatPut(endCluster - 1, endCluster)) 
-      return false;
-    endCluster--;
-  }
+  if (chain) {
+    // link clusters and mark end of chain
+    if (!fatLinkRun(bgnCluster, endCluster)) return false;
 
-  if (*curCluster != 0) {
-    // connect chains
-    if (!fatPut(*curCluster, bgnCluster)) 
-      return false;
+    if (*curCluster != 0) {
+      // connect chains
+      if (!fatPut(*curCluster, bgnCluster)) 
+        return false;
+    }
   }
 
   // return first cluster number to caller
@@ -106,52 +246,116 @@ uint8_t SpiSdVolume::allocContiguous(uint32_t count, uint32_t* curCluster)
   return true;
 }
 
-uint8_t SpiSdVolume::cacheFlush(void) 
+// mark the used clusters of one FAT block in the bitmap
+void SpiSdVolume::bitmapBlock(SpiSdVolume* vol, uint32_t cluster
+          ,const cache_t* pc, uint16_t n) 
 {
-  if (cacheDirty_) {
+  uint32_t* w = vol->bitmap_ + (cluster >> 5);
+
+  // a FAT block holds a whole number of bitmap words
+  for (uint16_t i = 0; i < n; i += 32, w++) {
+    uint16_t m = n - i < 32 ? n - i : 32;
+    uint32_t bits = 0;
+    if (vol->fatType_ == 16) {
+      const uint16_t* e = pc->fat16 + i;
+      for (uint16_t k = 0; k < m; k++) 
+        if (e[k]) bits |= 1UL << k;
+    } else {
+      const uint32_t* e = pc->fat32 + i;
+      for (uint16_t k = 0; k < m; k++) 
+        if (e[k] & FAT32MASK) bits |= 1UL << k;
+    }
+    *w = bits;
+  }
+}
 
-    if (!sdCard_->writeBlock(cacheBlockNumber_, cacheBuffer_.data)) 
-      return false;
+// allocate and fill the free cluster bitmap
+uint8_t SpiSdVolume::bitmapBuild(void) 
+{
+  free(bitmap_);
+  bitmap_ = 0;
+  if (fatType_ != 16 && fatType_ != 32) 
+    return false;
 
-    // mirror FAT tables
-    if (cacheMirrorBlock_) {
-      if (!sdCard_->writeBlock(cacheMirrorBlock_, cacheBuffer_.data)) 
-        return false;
-      cacheMirrorBlock_ = 0;
-    }
+  uint32_t end = clusterCount_ + 2;
+  uint32_t words = (end + 31) >> 5;
+  uint32_t* map = (uint32_t*)malloc(words * sizeof(uint32_t));
+  if (!map) 
+    return false;
 
-    cacheDirty_ = 0;
+  bitmap_ = map;
+  if (!fatScan(bitmapBlock)) {
+    free(bitmap_);
+    bitmap_ = 0;
+    return false;
+  }
+  // bits past the last cluster are set so they are never allocated
+  if (end & 31) 
+    bitmap_[words - 1] |= 0XFFFFFFFF << (end & 31);
+
+  // reserved clusters
+  bitmap_[0] |= 3;
+
+  // an exact free count, FSInfo may be stale
+  uint32_t n = 0;
+  for (uint32_t i = 0; i < words; i++) 
+    n += 32 - __builtin_popcount(bitmap_[i]);
+  if (n != freeCount_) {
+    freeCount_ = n;
+    fsInfoDirty_ = true;
   }
-
   return true;
 }
 
-uint8_t SpiSdVolume::cacheRawBlock(uint32_t blockNumber, uint8_t action) 
+// first cluster of count free clusters in a row in [from, to) or zero
+uint32_t SpiSdVolume::bitmapFind(uint32_t from, uint32_t to
+           ,uint32_t count) const 
 {
-  if (cacheBlockNumber_ != blockNumber) {
-    if (!cacheFlush()) 
-      return false;
-    if (!sdCard_->readBlock(blockNumber, cacheBuffer_.data)) 
-      return false;
-    cacheBlockNumber_ = blockNumber;
-  }
+  uint32_t run = 0;
+  uint32_t c = from;
+
+  while (c < to) {
+    uint32_t w = bitmap_[c >> 5];
+
+    // a word at a time while aligned
+    if ((c & 31) == 0 && (c + 32) <= to) {
+      if (w == 0XFFFFFFFF) {
+        run = 0;
+        c += 32;
+        continue;
+      }
+      if (w == 0) {
+        run += 32;
+        c += 32;
+        if (run >= count) 
+          return c - run;
+        continue;
+      }
+      if (count == 1) 
+        return c + __builtin_ctz(~w);
+    }
 
-  cacheDirty_ |= action;
-  return true;
+    if (w & (1UL << (c & 31))) {
+      run = 0;
+    } else if (++run == count) {
+      return c + 1 - count;
+    }
+    c++;
+  }
+  return 0;
 }
 
 // cache a zero block for blockNumber
 uint8_t SpiSdVolume::cacheZeroBlock(uint32_t blockNumber) 
 {
-  if (!cacheFlush()) 
+  cache_t* pc = cache_.fetch(blockNumber, CACHE_RESERVE_FOR_WRITE);
+  if (!pc) 
     return false;
 
-  // loop take less flash than memset(cacheBuffer_.data, 0, 512);
+  // loop take less flash than memset(pc->data, 0, 512);
   for (uint16_t i = 0; i < 512; i++) 
-    cacheBuffer_.data[i] = 0;
+    pc->data[i] = 0;
 
-  cacheBlockNumber_ = blockNumber;
-  cacheSetDirty();
   return true;
 }
 
@@ -169,25 +373,306 @@ uint8_t SpiSdVolume::chainSize(uint32_t cluster, uint32_t* size) const
   return true;
 }
 
+// remember a freed cluster, adjacent clusters are merged into one range
+void SpiSdVolume::discardAdd(uint32_t cluster) 
+{
+  for (uint8_t i = 0; i < discardCount_; i++) {
+    if (cluster == discardLast_[i] + 1) {
+      discardLast_[i] = cluster;
+      return;
+    }
+    if (cluster + 1 == discardFirst_[i]) {
+      discardFirst_[i] = cluster;
+      return;
+    }
+  }
+
+  // no room, the cluster just isn't erased
+  if (discardCount_ == SPISD_DISCARD_RANGES) 
+    return;
+
+  discardFirst_[discardCount_] = cluster;
+  discardLast_[discardCount_] = cluster;
+  discardCount_++;
+}
+
+// drop clusters first to last from the ranges waiting to be erased
+void SpiSdVolume::discardCancel(uint32_t first, uint32_t last) 
+{
+  uint8_t i = 0;
+  while (i < discardCount_) {
+    uint32_t f = discardFirst_[i];
+    uint32_t l = discardLast_[i];
+
+    if (last < f || first > l) {
+      // no overlap
+      i++;
+    } else if (first <= f && last >= l) {
+      // whole range allocated, move the last range into its slot
+      discardCount_--;
+      discardFirst_[i] = discardFirst_[discardCount_];
+      discardLast_[i] = discardLast_[discardCount_];
+    } else if (first <= f) {
+      discardFirst_[i++] = last + 1;
+    } else if (last >= l) {
+      discardLast_[i++] = first - 1;
+    } else {
+      // split the range, keep the larger part if there is no free slot
+      if (discardCount_ < SPISD_DISCARD_RANGES) {
+        discardFirst_[discardCount_] = last + 1;
+        discardLast_[discardCount_] = l;
+        discardCount_++;
+        discardLast_[i] = first - 1;
+      } else if ((first - f) > (l - last)) {
+        discardLast_[i] = first - 1;
+      } else {
+        discardFirst_[i] = last + 1;
+      }
+      i++;
+    }
+  }
+}
+
+/**
+ *  Erase all freed clusters that are waiting to be erased.
+ *
+ *  Nothing is erased on cards without single block erase.
+ *
+ *  \return The value one, true, is returned for success and
+ *  the value zero, false, is returned for failure.
+ */
+uint8_t SpiSdVolume::discardFlush(void) 
+{
+  // the FAT must show the clusters free before their data goes
+  if (!cacheFlush()) 
+    return false;
+
+  while (discardCount_) {
+    if (!discardRange(discardCount_ - 1, true)) 
+      return false;
+  }
+  return true;
+}
+
+/**
+ *  Start erasing one range of freed clusters if the card is idle and
+ *  no cached block is waiting to be written.  Call from loop() when
+ *  the discard mode is SD_DISCARD_IDLE, SpiSDClass::poll() does this.
+ *  At most SPISD_DISCARD_POLL_BLOCKS blocks are erased per call.  The
+ *  next card command waits until the erase has finished, which may
+ *  take up to the card's erase timeout.
+ *
+ *  \return The value one, true, is returned if an erase was started and
+ *  the value zero, false, is returned if nothing was started.
+ */
+uint8_t SpiSdVolume::discardPoll(void) 
+{
+  if (!discardCount_ || cache_.dirty() || fatCache_.dirty() 
+    || mirrorFirst_ <= mirrorLast_ || fatRamChanged_ 
+    || sdCard_->asyncBusy()) 
+    return false;
+  return discardRange(discardCount_ - 1, false);
+}
+
+// erase the blocks of range i and remove it from the list, without wait
+// erase at most SPISD_DISCARD_POLL_BLOCKS and keep the rest of the range
+uint8_t SpiSdVolume::discardRange(uint8_t i, uint8_t wait) 
+{
+  uint32_t first = clusterStartBlock(discardFirst_[i]);
+  uint32_t last = clusterStartBlock(discardLast_[i] + 1) - 1;
+
+  uint32_t maxClusters = SPISD_DISCARD_POLL_BLOCKS >> clusterSizeShift_;
+  if (!maxClusters) maxClusters = 1;
+  if (!wait && discardLast_[i] - discardFirst_[i] >= maxClusters) {
+    // erase the start of the range now, the rest on later calls
+    discardFirst_[i] += maxClusters;
+    last = clusterStartBlock(discardFirst_[i]) - 1;
+  } else {
+    discardCount_--;
+    discardFirst_[i] = discardFirst_[discardCount_];
+    discardLast_[i] = discardLast_[discardCount_];
+  }
+
+  // erase is only a hint, skip cards that can't erase single blocks
+  if (!sdCard_->eraseSingleBlockEnable()) {
+    discardCount_ = 0;
+    return true;
+  }
+  return wait ? sdCard_->erase(first, last)
+              : sdCard_->eraseAsync(first, last);
+}
+
+// read the layout of an exFAT volume from the cached boot sector and
+// find the allocation bitmap and up-case table in the root directory
+uint8_t SpiSdVolume::exFatInit(uint32_t volumeStartBlock) 
+{
+  exfbs_t* bs = &cacheBuffer()->exfbs;
+  if (bs->bytesPerSectorShift != 9 
+    || bs->sectorsPerClusterShift > 16 
+    || bs->numberOfFats == 0) 
+  {
+    return false;
+  }
+
+  // TexFAT volumes have two FATs, a flag selects the one in use
+  uint8_t activeFat = bs->numberOfFats > 1 && (bs->volumeFlags & 1);
+
+  fatCount_ = bs->numberOfFats;
+  clusterSizeShift_ = bs->sectorsPerClusterShift;
+  blocksPerCluster_ = 1UL << clusterSizeShift_;
+  blocksPerFat_ = bs->fatLength;
+  fatStartBlock_ = volumeStartBlock + bs->fatOffset 
+                 + activeFat * blocksPerFat_;
+  dataStartBlock_ = volumeStartBlock + bs->clusterHeapOffset;
+  clusterCount_ = bs->clusterCount;
+  rootDirStart_ = bs->rootDirectoryCluster;
+  rootDirEntryCount_ = 0;
+  fatType_ = 64;
+
+  // the FATs are not copies of each other
+  mirrorOffset_ = blocksPerFat_;
+  mirrorCopies_ = 0;
+
+  uint32_t cluster = rootDirStart_;
+  for (uint32_t n = 0; !allocBitmapStart_ || !upcaseStart_; n++) {
+    uint32_t b = n & (blocksPerCluster_ - 1);
+    if (n && b == 0) {
+      if (!fatGet(cluster, &cluster) || isEOC(cluster)) 
+        return false;
+    }
+    if (!cacheRawBlock(clusterStartBlock(cluster) + b, CACHE_FOR_READ)) 
+      return false;
+
+    for (uint8_t i = 0; i < 16; i++) {
+      dir_t* d = cacheBuffer()->dir + i;
+      if (d->name[0] == EXFAT_TYPE_END) 
+        return allocBitmapStart_ && upcaseStart_ && upcaseLoad();
+
+      if (d->name[0] == EXFAT_TYPE_BITMAP) {
+        exbitmap_t* e = reinterpret_cast<exbitmap_t*>(d);
+        if ((e->flags & 1) == activeFat) 
+          allocBitmapStart_ = clusterStartBlock(e->firstCluster);
+      } else if (d->name[0] == EXFAT_TYPE_UPCASE) {
+        exupcase_t* e = reinterpret_cast<exupcase_t*>(d);
+        upcaseStart_ = clusterStartBlock(e->firstCluster);
+        upcaseSize_ = e->size / 2;
+      }
+    }
+  }
+  return upcaseLoad();
+}
+
+// number of zero entries in bytes of FAT, eight bytes at a time.  The
+// high bit of a lane is set if the lane is zero: adding low to the low
+// bits carries into it unless they are zero, or-ing x adds the high bit.
+static uint16_t countZero(const uint8_t* p, uint16_t bytes
+          ,uint64_t mask, uint64_t low) 
+{
+  uint16_t n = 0;
+  for (uint16_t i = 0; i < bytes; i += 8) {
+    uint64_t x;
+    memcpy(&x, p + i, 8);
+    x &= mask;
+    n += __builtin_popcountll(~(((x & low) + low) | x | low));
+  }
+  return n;
+}
+
+// add the free clusters of one FAT block to freeCount_
+void SpiSdVolume::countBlock(SpiSdVolume* vol, uint32_t cluster
+          ,const cache_t* pc, uint16_t n) 
+{
+  // entries that fill whole 64 bit words, then the rest one at a time
+  uint16_t whole = n & ~(vol->fatType_ == 16 ? 3 : 1);
+  uint16_t k;
+  if (vol->fatType_ == 16) {
+    k = countZero(pc->data, 2*whole
+          ,0XFFFFFFFFFFFFFFFFULL, 0X7FFF7FFF7FFF7FFFULL);
+    for (uint16_t i = whole; i < n; i++) 
+      if (pc->fat16[i] == 0) k++;
+  } else {
+    k = countZero(pc->data, 4*whole
+          ,0X0FFFFFFF0FFFFFFFULL, 0X7FFFFFFF7FFFFFFFULL);
+    for (uint16_t i = whole; i < n; i++) 
+      if ((pc->fat32[i] & FAT32MASK) == 0) k++;
+  }
+
+  // entries zero and one are reserved, not free clusters
+  if (cluster == 0) {
+    for (uint8_t i = 0; i < 2; i++) {
+      if (vol->fatType_ == 16 ? pc->fat16[i] == 0 
+            : (pc->fat32[i] & FAT32MASK) == 0) {
+        k--;
+      }
+    }
+  }
+  vol->freeCount_ += k;
+}
+
 // Fetch a FAT entry
 uint8_t SpiSdVolume::fatGet(uint32_t cluster, uint32_t* value) const 
 {
   if (cluster > (clusterCount_ + 1)) return false;
 
-  uint32_t lba = fatStartBlock_;
-  lba += fatType_ == 16 ? cluster >> 8 : cluster >> 7;
-  if (lba != cacheBlockNumber_) 
-    if (!cacheRawBlock(lba, CACHE_FOR_READ)) 
-      return false;
+  uint32_t lba = fatBlock(cluster);
+  const cache_t* pc = fatRam_ ? fatRam_ + (lba - fatStartBlock_)
+    : fatCache_.fetch(lba, CACHE_FOR_READ, SpiSdCache::PIN_FAT);
+  if (!pc) 
+    return false;
 
-  if (fatType_ == 16) 
-    *value = cacheBuffer_.fat16[cluster & 0XFF];
-  else
-    *value = cacheBuffer_.fat32[cluster & 0X7F] & FAT32MASK;
+  *value = fatEntry(pc, cluster);
+  return true;
+}
+
+// link clusters first to last into a chain ending with an end of chain
+// mark, each FAT block is fetched once
+uint8_t SpiSdVolume::fatLinkRun(uint32_t first, uint32_t last) 
+{
+  if (first < 2 || last > (clusterCount_ + 1)) 
+    return false;
 
+  uint32_t perBlock = fatType_ == 16 ? 256 : 128;
+  while (first <= last) {
+    // last cluster of the run in this block
+    uint32_t end = first | (perBlock - 1);
+    if (end > last) end = last;
+
+    // a block of free entries that the run fills is not read
+    uint8_t whole = (first & (perBlock - 1)) == 0 
+                 && (end & (perBlock - 1)) == (perBlock - 1);
+    cache_t* pc = fatWriteBlock(fatBlock(first)
+                    ,whole ? CACHE_RESERVE_FOR_WRITE : CACHE_FOR_WRITE);
+    if (!pc) 
+      return false;
+    if (whole) memset(pc->data, 0, 512);
+
+    for (; first < end; first++) 
+      fatStore(pc, first, first + 1);
+    fatStore(pc, first, first == last ? 0x0FFFFFFF : first + 1);
+    first++;
+  }
   return true;
 }
 
+// number of clusters from cluster on, up to the end of its cached FAT
+// block, whose entry links to the next cluster
+uint32_t SpiSdVolume::fatRunLength(uint32_t cluster) const 
+{
+  uint32_t lba = fatBlock(cluster);
+  const cache_t* pc = fatRam_ ? fatRam_ + (lba - fatStartBlock_)
+                              : fatCache_.find(lba);
+  if (!pc) 
+    return 0;
+
+  uint32_t last = cluster | (fatType_ == 16 ? 0XFF : 0X7F);
+  if (last > clusterCount_) last = clusterCount_;
+
+  uint32_t c = cluster;
+  while (c <= last && fatEntry(pc, c) == c + 1) 
+    c++;
+  return c - cluster;
+}
+
 // Store a FAT entry
 uint8_t SpiSdVolume::fatPut(uint32_t cluster, uint32_t value) 
 {
@@ -199,51 +684,376 @@ uint8_t SpiSdVolume::fatPut(uint32_t cluster, uint32_t value)
   if (cluster > (clusterCount_ + 1)) 
     return false;
 
-  // calculate block address for entry
-  uint32_t lba = fatStartBlock_;
-  lba += fatType_ == 16 ? cluster >> 8 : cluster >> 7;
+  cache_t* pc = fatWriteBlock(fatBlock(cluster));
+  if (!pc) 
+    return false;
 
-  if (lba != cacheBlockNumber_) 
-    if (!cacheRawBlock(lba, CACHE_FOR_READ)) 
-      return false;
+  fatStore(pc, cluster, value);
+  return true;
+}
+
+// store an entry in the FAT block that holds it
+void SpiSdVolume::fatStore(cache_t* pc, uint32_t cluster, uint32_t value) 
+{
+  // exFAT keeps allocation in its bitmap, the FAT only links clusters
+  if (fatType_ == 64) {
+    pc->fat32[cluster & 0X7F] = value == FAT32EOC ? EXFAT_EOC : value;
+    return;
+  }
+
+  uint32_t old = fatEntry(pc, cluster);
 
   // store entry
   if (fatType_ == 16) 
-    cacheBuffer_.fat16[cluster & 0XFF] = value;
+    pc->fat16[cluster & 0XFF] = value;
   else 
-    cacheBuffer_.fat32[cluster & 0X7F] = value;
+    pc->fat32[cluster & 0X7F] = value;
+
+  // cluster allocated or freed
+  if ((old == 0) != (value == 0)) {
+    if (freeCount_ != 0XFFFFFFFF) 
+      freeCount_ += value ? -1 : 1;
+    fsInfoDirty_ = true;
+  }
 
-  cacheSetDirty();
+  if (bitmap_) bitmapSet(cluster, value != 0);
+}
+
+// fetch a FAT block for changes, returns zero for an I/O error
+cache_t* SpiSdVolume::fatWriteBlock(uint32_t lba, uint8_t action) 
+{
+  // the FAT in RAM is written to every FAT copy by cacheFlush()
+  if (fatRam_) {
+    uint32_t i = lba - fatStartBlock_;
+    fatRamDirty_[i >> 3] |= 1 << (i & 7);
+    fatRamChanged_ = true;
+    return fatRam_ + i;
+  }
+
+  // write-through, only the block being changed may be dirty
+  if (!fatWriteBack_ && lba != fatCache_.blockNumber()) {
+    if (!fatCache_.flush()) 
+      return 0;
+  }
+
+  // deferred mirror, copying the pending range may replace cache entries
+  if (mirrorCopies_ && mirrorDefer_) {
+    if (mirrorFirst_ > mirrorLast_) {
+      mirrorFirst_ = mirrorLast_ = lba;
+    } else if (lba + MIRROR_MAX_GAP < mirrorFirst_ 
+            || lba > mirrorLast_ + MIRROR_MAX_GAP) {
+      // far from the pending range, copy it and start a new one
+      if (!mirrorFlush()) 
+        return 0;
+      mirrorFirst_ = mirrorLast_ = lba;
+    } else if (lba < mirrorFirst_) {
+      mirrorFirst_ = lba;
+    } else if (lba > mirrorLast_) {
+      mirrorLast_ = lba;
+    }
+  }
+
+  cache_t* pc = fatCache_.fetch(lba, action, SpiSdCache::PIN_FAT);
 
   // mirror second FAT
-  if (fatCount_ > 1) 
-    cacheMirrorBlock_ = lba + blocksPerFat_;
+  if (pc && mirrorCopies_ && !mirrorDefer_) 
+    fatCache_.setMirror(lba + blocksPerFat_);
+
+  return pc;
+}
+
+/**
+ *  Keep the whole first FAT in RAM.  init() loads it with one multiple
+ *  block read, FAT lookups and changes then never wait for the card and
+ *  the changed blocks are written to every FAT copy by flush(),
+ *  SpiSdFile::sync() and SpiSdFile::close().  A FAT larger than
+ *  \a maxBytes stays on the card and goes through the FAT cache, as
+ *  does the FAT of an exFAT volume.
+ *
+ *  \param[in] maxBytes Largest FAT to load, zero to use the FAT cache.
+ *  \return The value one, true, is returned if the FAT is in RAM, or
+ *  will be loaded by init() when no volume is mounted, and the value
+ *  zero, false, is returned if the FAT is too large, there is not
+ *  enough memory or an I/O error occurred.
+ */
+uint8_t SpiSdVolume::fatInRam(uint32_t maxBytes) 
+{
+  fatRamMax_ = maxBytes;
+  if (!fatType_) 
+    return maxBytes != 0;
+  if (maxBytes) 
+    return fatRamLoad();
+
+  // back to the FAT cache
+  if (!fatRamFlush()) 
+    return false;
+  fatRamFree();
+  return true;
+}
 
+// write the changed blocks of the FAT in RAM to every FAT copy, runs of
+// adjacent changed blocks with one multiple block write
+uint8_t SpiSdVolume::fatRamFlush(void) 
+{
+  if (!fatRamChanged_) 
+    return true;
+
+  uint32_t i = 0;
+  while (i < fatRamBlocks_) {
+    if (!(fatRamDirty_[i >> 3] & (1 << (i & 7)))) {
+      // skip eight clean blocks at a time
+      i = fatRamDirty_[i >> 3] ? i + 1 : (i | 7) + 1;
+      continue;
+    }
+    uint32_t n = 1;
+    while ((i + n) < fatRamBlocks_ 
+      && (fatRamDirty_[(i + n) >> 3] & (1 << ((i + n) & 7)))) {
+      n++;
+    }
+    for (uint8_t k = 0; k <= mirrorCopies_; k++) {
+      if (!sdCard_->writeBlocks(fatRamStart_ + k*mirrorOffset_ + i
+             ,n, fatRam_[i].data)) {
+        return false;
+      }
+    }
+    for (; n; n--, i++) 
+      fatRamDirty_[i >> 3] &= ~(1 << (i & 7));
+  }
+  fatRamChanged_ = false;
+  return true;
+}
+
+// drop the FAT in RAM without writing it
+void SpiSdVolume::fatRamFree(void) 
+{
+  free(fatRam_);
+  free(fatRamDirty_);
+  fatRam_ = 0;
+  fatRamDirty_ = 0;
+  fatRamBlocks_ = 0;
+  fatRamChanged_ = false;
+}
+
+// read the first FAT into RAM if it is no larger than fatRamMax_
+uint8_t SpiSdVolume::fatRamLoad(void) 
+{
+  // the card and the FAT cache must have the current FAT
+  if (!fatRamFlush() || !fatCache_.flush() || !mirrorFlush()) 
+    return false;
+  fatRamFree();
+
+  if (fatType_ != 16 && fatType_ != 32) 
+    return false;
+
+  uint16_t perBlock = fatType_ == 16 ? 256 : 128;
+  uint32_t blocks = (clusterCount_ + 2 + perBlock - 1) / perBlock;
+  if (blocks > (fatRamMax_ >> 9)) 
+    return false;
+
+  cache_t* ram = (cache_t*)malloc(blocks * sizeof(cache_t));
+  uint8_t* dirty = (uint8_t*)calloc((blocks + 7) >> 3, 1);
+  if (!ram || !dirty 
+    || !sdCard_->readBlocks(fatStartBlock_, blocks, ram->data)) {
+    free(ram);
+    free(dirty);
+    return false;
+  }
+
+  // FAT blocks now come from RAM only
+  fatCache_.invalidate(0, 0XFFFFFFFF);
+  fatRam_ = ram;
+  fatRamDirty_ = dirty;
+  fatRamBlocks_ = blocks;
+  fatRamStart_ = fatStartBlock_;
+  return true;
+}
+
+// copy the changed range of the first FAT to the other FATs
+uint8_t SpiSdVolume::mirrorFlush(void) 
+{
+  if (mirrorFirst_ > mirrorLast_) 
+    return true;
+
+  if (!fatCache_.copy(mirrorFirst_, mirrorLast_ - mirrorFirst_ + 1
+         ,mirrorOffset_, mirrorCopies_)) {
+    return false;
+  }
+  mirrorFirst_ = 0XFFFFFFFF;
+  mirrorLast_ = 0;
+  return true;
+}
+
+// read the first FAT with one multiple block read, fn is called for
+// each block with the first cluster of the block and its entry count
+uint8_t SpiSdVolume::fatScan(void (*fn)(SpiSdVolume* vol, uint32_t cluster
+          ,const cache_t* pc, uint16_t n)) 
+{
+  cache_t buf;
+  uint16_t perBlock = fatType_ == 16 ? 256 : 128;
+  uint32_t end = clusterCount_ + 2;
+  uint32_t blocks = (end + perBlock - 1) / perBlock;
+  uint32_t i = 0;
+
+  if (fatRam_) {
+    for (; i < blocks; i++) {
+      uint32_t cluster = i * perBlock;
+      fn(this, cluster, fatRam_ + i
+         ,(end - cluster) < perBlock ? end - cluster : perBlock);
+    }
+    return true;
+  }
+
+  // the card must have the current FAT
+  if (!fatCache_.flush()) 
+    return false;
+
+  for (uint8_t retry = 0; ; retry++) {
+    if (sdCard_->readStart(fatStartBlock_ + i)) {
+      for (; i < blocks; i++) {
+        if (!sdCard_->readData(buf.data)) 
+          break;
+        uint32_t cluster = i * perBlock;
+        fn(this, cluster, &buf
+           ,(end - cluster) < perBlock ? end - cluster : perBlock);
+      }
+      uint8_t stopped = sdCard_->readStop();
+      if (i == blocks) 
+        return stopped;
+    }
+    // continue with the failed block
+    if (!sdCard_->useCrc() || retry >= SD_CRC_RETRIES) 
+      return false;
+  }
+}
+
+/**
+ *  Count the free clusters.  The count from FSInfo or the free cluster
+ *  bitmap is used if there is one, otherwise the FAT, or the allocation
+ *  bitmap of an exFAT volume, is read with one multiple block read.
+ *  The count is then kept current by allocation and freeing, so only
+ *  the first call reads the card.
+ *
+ *  \param[in] recount Read the FAT even if the count is known.
+ *  \return The number of free clusters or 0XFFFFFFFF for an I/O error.
+ */
+uint32_t SpiSdVolume::freeClusterCount(uint8_t recount) 
+{
+  if (freeCount_ != 0XFFFFFFFF && !recount) 
+    return freeCount_;
+
+  if (fatType_ == 64) {
+    freeCount_ = allocBitmapCount();
+    return freeCount_;
+  }
+
+  if (fatType_ != 16 && fatType_ != 32) 
+    return 0XFFFFFFFF;
+
+  uint32_t before = freeCount_;
+  freeCount_ = 0;
+  if (!fatScan(countBlock)) {
+    freeCount_ = 0XFFFFFFFF;
+    return 0XFFFFFFFF;
+  }
+  if (freeCount_ != before) 
+    fsInfoDirty_ = true;
+  return freeCount_;
+}
+
+/**
+ *  Keep a bitmap of used clusters in RAM, one bit per cluster, so
+ *  that allocation does not read the FAT.  The bitmap is built with
+ *  one pass over the FAT by init() or at once if the volume is
+ *  mounted, and fatPut() keeps it current.  exFAT volumes search their
+ *  own allocation bitmap instead.
+ *
+ *  \param[in] enable Use the bitmap if true.
+ *  \return The value one, true, is returned for success and the value
+ *  zero, false, is returned if there is not enough memory or the FAT
+ *  could not be read.  Allocation then searches the FAT.
+ */
+uint8_t SpiSdVolume::freeBitmap(uint8_t enable) 
+{
+  useBitmap_ = enable;
+  if (enable && fatType_) 
+    return bitmapBuild();
+
+  free(bitmap_);
+  bitmap_ = 0;
   return true;
 }
 
 // free a cluster chain
 uint8_t SpiSdVolume::freeChain(uint32_t cluster) 
 {
-  // clear free cluster location
-  allocSearchStart_ = 2;
+  // the next search starts at the freed chain if it is earlier
+  if (cluster < allocSearchStart_) 
+    allocSearchStart_ = cluster;
 
+  // clusters in the same FAT block are freed with one fetch
+  uint32_t lba = 0;
+  cache_t* pc = 0;
   do {
-    uint32_t next;
-    if (!fatGet(cluster, &next)) 
+    if (cluster < 2 || cluster > (clusterCount_ + 1)) 
       return false;
 
-    if (!fatPut(cluster, 0)) 
+    if (!pc || fatBlock(cluster) != lba) {
+      lba = fatBlock(cluster);
+      pc = fatWriteBlock(lba);
+      if (!pc) 
+        return false;
+    }
+
+    uint32_t next = fatEntry(pc, cluster);
+    fatStore(pc, cluster, 0);
+    if (fatType_ == 64 && !allocBitmapSet(cluster, 1, false)) 
       return false;
 
+    if (discardMode_) discardAdd(cluster);
+
     cluster = next;
   } while (!isEOC(cluster));
 
   return true;
 }
 
+// free count clusters from cluster on, an exFAT run with no FAT chain
+uint8_t SpiSdVolume::freeRun(uint32_t cluster, uint32_t count) 
+{
+  if (count == 0) 
+    return true;
+  if (cluster < 2 || cluster + count > clusterCount_ + 2) 
+    return false;
+
+  // the next search starts at the freed run if it is earlier
+  if (cluster < allocSearchStart_) 
+    allocSearchStart_ = cluster;
+
+  if (discardMode_) {
+    for (uint32_t i = 0; i < count; i++) 
+      discardAdd(cluster + i);
+  }
+  return allocBitmapSet(cluster, count, false);
+}
+
+// put the free count and search start in the FSInfo sector
+uint8_t SpiSdVolume::fsInfoSync(void) 
+{
+  if (!fsInfoDirty_ || !fsInfoBlock_) 
+    return true;
+
+  if (!cacheRawBlock(fsInfoBlock_, CACHE_FOR_WRITE)) 
+    return false;
+
+  fsinfo_t* fsi = &cacheBuffer()->fsinfo;
+  fsi->freeCount = freeCount_;
+  fsi->nextFree = allocSearchStart_;
+  fsInfoDirty_ = false;
+  return true;
+}
+
 /**
- * Initialize a FAT volume.
+ * Initialize a FAT16, FAT32 or exFAT volume.
  *
  * \param[in] dev The SD card where the volume is located.
  *
@@ -261,6 +1071,20 @@ uint8_t SpiSdVolume::init(SpiSd2Card* dev, uint8_t part)
 {
   uint32_t volumeStartBlock = 0;
   sdCard_ = dev;
+  cache_.init(dev);
+  fatCache_.init(dev);
+  fatRamFree();
+  mirrorFirst_ = 0XFFFFFFFF;
+  mirrorLast_ = 0;
+  allocSearchStart_ = 2;
+  fsInfoBlock_ = 0;
+  freeCount_ = 0XFFFFFFFF;
+  fsInfoDirty_ = false;
+  allocBitmapStart_ = 0;
+  upcaseStart_ = 0;
+  upcaseSize_ = 0;
+  upcaseCount_ = 0;
+  upcaseLimit_ = 0;
 
   // if part == 0 assume super floppy with FAT boot sector in block zero
   // if part > 0 assume mbr volume with partition table
@@ -271,7 +1095,7 @@ uint8_t SpiSdVolume::init(SpiSd2Card* dev, uint8_t part)
     if (!cacheRawBlock(volumeStartBlock, CACHE_FOR_READ)) 
       return false;
 
-    part_t* p = &cacheBuffer_.mbr.part[part-1];
+    part_t* p = &cacheBuffer()->mbr.part[part-1];
     if ((p->boot & 0X7F) != 0
       || p->totalSectors < 100
       || p->firstSector == 0) {
@@ -285,7 +1109,11 @@ uint8_t SpiSdVolume::init(SpiSd2Card* dev, uint8_t part)
   if (!cacheRawBlock(volumeStartBlock, CACHE_FOR_READ)) 
     return false;
 
-  bpb_t* bpb = &cacheBuffer_.fbs.bpb;
+  // exFAT has its own boot sector layout
+  if (!memcmp(cacheBuffer()->exfbs.oemName, "EXFAT   ", 8)) 
+    return exFatInit(volumeStartBlock);
+
+  bpb_t* bpb = &cacheBuffer()->fbs.bpb;
   if (bpb->bytesPerSector != 512 
     || bpb->fatCount == 0 
     || bpb->reservedSectorCount == 0
@@ -296,11 +1124,13 @@ uint8_t SpiSdVolume::init(SpiSd2Card* dev, uint8_t part)
   }
 
   fatCount_ = bpb->fatCount;
+  uint16_t fsInfo = bpb->fat32FSInfo;
+  uint16_t reserved = bpb->reservedSectorCount;
   blocksPerCluster_ = bpb->sectorsPerCluster;
 
   // determine shift that is same as multiply by blocksPerCluster_
   clusterSizeShift_ = 0;
-  while (blocksPerCluster_ != (1 << clusterSizeShift_)) {
+  while (blocksPerCluster_ != (1UL << clusterSizeShift_)) {
     // error if not power of 2
     if (clusterSizeShift_++ > 7) return false;
   }
@@ -308,6 +1138,10 @@ uint8_t SpiSdVolume::init(SpiSd2Card* dev, uint8_t part)
   blocksPerFat_ = bpb->sectorsPerFat16 ?
                     bpb->sectorsPerFat16 : bpb->sectorsPerFat32;
 
+  // FAT copies written along with the first FAT
+  mirrorOffset_ = blocksPerFat_;
+  mirrorCopies_ = fatCount_ - 1;
+
   fatStartBlock_ = volumeStartBlock + bpb->reservedSectorCount;
 
   // count for FAT16 zero for FAT32
@@ -338,5 +1172,151 @@ uint8_t SpiSdVolume::init(SpiSd2Card* dev, uint8_t part)
     fatType_ = 32;
   }
 
+  // FAT32 keeps a free cluster count and a search start in FSInfo
+  if (fatType_ == 32 && fsInfo && fsInfo < reserved) {
+    if (!cacheRawBlock(volumeStartBlock + fsInfo, CACHE_FOR_READ)) 
+      return false;
+
+    fsinfo_t* fsi = &cacheBuffer()->fsinfo;
+    if (fsi->leadSignature == FSINFO_LEAD_SIG
+      && fsi->structSignature == FSINFO_STRUCT_SIG) {
+      fsInfoBlock_ = volumeStartBlock + fsInfo;
+      if (fsi->freeCount <= clusterCount_) 
+        freeCount_ = fsi->freeCount;
+      if (fsi->nextFree >= 2 && fsi->nextFree <= clusterCount_ + 1) 
+        allocSearchStart_ = fsi->nextFree;
+    }
+  }
+
+  // the FAT in RAM and the bitmap only speed things up, mount without
+  // them if they fail
+  if (fatRamMax_) 
+    fatRamLoad();
+  if (useBitmap_) 
+    bitmapBuild();
+
+  return true;
+}
+
+/**
+ *  Write cached blocks when a limit set by writeBack(uint8_t, uint32_t)
+ *  has been reached.  Call often from loop(), SpiSDClass::tick() does
+ *  this, so the age limit holds while no file is being written.
+ *
+ *  \return The value one, true, is returned for success and
+ *  the value zero, false, is returned for failure.
+ */
+uint8_t SpiSdVolume::tick(void) 
+{
+  return writeBackDue() ? flush() : true;
+}
+
+// upper case of character c from the exFAT up-case table, c itself if
+// the table maps it to itself or can't be read
+uint16_t SpiSdVolume::upcase(uint16_t c) 
+{
+  if (c < upcaseLimit_) {
+    // binary search of the characters the table changes
+    uint8_t lo = 0;
+    uint8_t hi = upcaseCount_;
+    while (lo < hi) {
+      uint8_t mid = (lo + hi) >> 1;
+      if (upcaseChar_[mid] < c) 
+        lo = mid + 1;
+      else
+        hi = mid;
+    }
+    return lo < upcaseCount_ && upcaseChar_[lo] == c ? upcaseUpper_[lo] : c;
+  }
+
+  // rest of the table, read past the cache so it keeps its blocks
+  cache_t buf;
+  uint32_t ch = upcaseLimit_;  // character mapped by the next table entry
+  uint8_t run = false;  // the entry is the length of an unchanged run
+
+  for (uint32_t i = upcaseIndex_; i < upcaseSize_ && ch <= c; i++) {
+    if (i == upcaseIndex_ || (i & 0XFF) == 0) {
+      if (!readBlock(upcaseStart_ + (i >> 8), buf.data)) 
+        return c;
+    }
+    uint16_t e = buf.fat16[i & 0XFF];
+    if (run) {
+      ch += e;
+      run = false;
+    } else if (e == 0XFFFF) {
+      run = true;
+    } else {
+      if (ch == c) 
+        return e;
+      ch++;
+    }
+  }
+  return c;
+}
+
+// decode the up-case table once, the characters it changes go to
+// upcaseChar_/upcaseUpper_ until they are full, upcaseLimit_ is the
+// first character left to upcase() and upcaseIndex_ its table entry
+uint8_t SpiSdVolume::upcaseLoad(void) 
+{
+  const cache_t* pc = 0;
+  uint32_t ch = 0;      // character mapped by the next table entry
+  uint8_t run = false;  // the entry is the length of an unchanged run
+
+  upcaseCount_ = 0;
+  for (uint32_t i = 0; i < upcaseSize_; i++) {
+    if ((i & 0XFF) == 0) {
+      pc = cache_.fetch(upcaseStart_ + (i >> 8), CACHE_FOR_READ);
+      if (!pc) 
+        return false;
+    }
+    uint16_t e = pc->fat16[i & 0XFF];
+    if (run) {
+      ch += e;
+      run = false;
+    } else if (e == 0XFFFF) {
+      run = true;
+    } else {
+      if (e != ch) {
+        if (upcaseCount_ == SPISD_UPCASE_PAIRS) {
+          upcaseLimit_ = ch;
+          upcaseIndex_ = i;
+          return true;
+        }
+        upcaseChar_[upcaseCount_] = ch;
+        upcaseUpper_[upcaseCount_++] = e;
+      }
+      ch++;
+    }
+  }
+  // characters past the table map to themselves
+  upcaseLimit_ = 0X10000;
+  upcaseIndex_ = upcaseSize_;
   return true;
 }
+
+// true if the write-back policy wants the cache written now, starts
+// the age limit clock at the first change after a flush
+uint8_t SpiSdVolume::writeBackDue(void) 
+{
+  if (!flushDirty_ && !flushMs_) 
+    return false;
+
+  uint8_t n = cache_.dirty() + fatCache_.dirty() + (fatRamChanged_ ? 1 : 0);
+  if (!n && !fsInfoDirty_ && mirrorFirst_ > mirrorLast_) {
+    dirtySince_ = 0;
+    return false;
+  }
+  if (flushDirty_ && n >= flushDirty_) 
+    return true;
+  if (!flushMs_) 
+    return false;
+
+  // zero means clean so a change at millis() zero is stamped one
+  uint32_t now = millis();
+  if (!dirtySince_) {
+    dirtySince_ = now | 1;
+    return false;
+  }
+  return now - dirtySince_ >= flushMs_;
+}